@@ -1,11 +1,13 @@
 /* RollEngine basic roll and math functions. */
 #include "rollengine.h"
 
+/* Number of dice RollTheBones rolls into its buffer at a time. */
+#define DICE_BATCH 1024
 
 
-/* This is where the magic happens; the dice roll function. For better or for
- * worse... time to roll the bones and see how lady luck dances. */
-double RollEngine::RollTheBones(double count, double sides)
+/* Apply the limits on dice rolls to the passed count and sides, adding
+ * warnings to the results for any that had to be changed. */
+void RollEngine::CheckDice(double& count, double& sides)
 {
 	/* Limit the maximum number of dice rolled to 0 to 10000. */
 	if (count < 0)
@@ -58,27 +60,178 @@ double RollEngine::RollTheBones(double count, double sides)
 			sides = round(sides);
 		}
 	}
+}
+
+
+
+/* This is where the magic happens; the dice roll function. For better or for
+ * worse... time to roll the bones and see how lady luck dances. */
+double RollEngine::RollTheBones(double count, double sides)
+{
+	CheckDice(count, sides);
+
+	/* Checks complete, perform the roll! As a count which isn't a number
+	 * rolls no dice, it must be converted with care. */
+	return (double)RollTotal(count > 0 ? (size_t)count : 0, (unsigned int)sides);
+}
+
 
-	/* Checks complete, perform the roll! */
-	double total = 0;
-	for (unsigned int i = 0; i < count; i++)
-		total += (double)Random((unsigned int)sides);
-	
-	/* Return the result. */
+
+uint64_t RollEngine::RollTotal(size_t count, unsigned int sides)
+{
+	/* Single dice are common enough to be worth skipping the bulk kernels
+	 * for. */
+	if (count == 1)
+	{
+		uint32_t face = Random(sides);
+		RecordDice(&face, 1, sides);
+		return face;
+	}
+
+	uint32_t faces[DICE_BATCH];
+	uint64_t total = 0;
+	if (recording)
+		results->AddDice(sides, count);
+	for (size_t done = 0; done < count; done += DICE_BATCH)
+	{
+		size_t batch = std::min((size_t)DICE_BATCH, count - done);
+		RollDice(faces, batch, sides);
+		total += SumDice(faces, batch);
+		if (recording)
+			results->AddFaces(faces, batch);
+	}
 	return total;
 }
 
 
 
+/* Roll a dice roll for each of lanes trials. The dice for each run of trials
+ * with the same sides are all rolled together, and handed out to the trials
+ * in turn. */
+void RollEngine::RollTheBones(double* counts, double* sides, size_t lanes)
+{
+	for (size_t lane = 0; lane < lanes; lane++)
+		CheckDice(counts[lane], sides[lane]);
+
+	/* When held for the roll data, each trial's dice are held as they are
+	 * handed out to it. */
+	if (holding)
+	{
+		for (size_t lane = 0; lane < lanes; lane++)
+			HoldDice(lane, (unsigned int)sides[lane], counts[lane] > 0 ? (size_t)counts[lane] : 0);
+	}
+
+	uint32_t faces[DICE_BATCH];
+	size_t lane = 0;
+	while (lane < lanes)
+	{
+		/* Find the run, and count its dice. Counts which aren't a
+		 * number roll no dice, as in RollTheBones() for one roll. */
+		unsigned int die = (unsigned int)sides[lane];
+		size_t end = lane;
+		size_t dice = 0;
+		for (; end < lanes && (unsigned int)sides[end] == die; end++)
+			dice += counts[end] > 0 ? (size_t)counts[end] : 0;
+
+		size_t needed = counts[lane] > 0 ? (size_t)counts[lane] : 0;
+		uint64_t total = 0;
+		while (dice)
+		{
+			size_t batch = std::min((size_t)DICE_BATCH, dice);
+			RollDice(faces, batch, die);
+			dice -= batch;
+
+			size_t used = 0;
+			while (used < batch)
+			{
+				size_t taken = std::min(needed, batch - used);
+				total += SumDice(faces + used, taken);
+				if (holding)
+					HoldFaces(lane, faces + used, taken);
+				used += taken;
+				needed -= taken;
+				if (!needed)
+				{
+					counts[lane] = (double)total;
+					total = 0;
+					lane++;
+					needed = lane < end && counts[lane] > 0 ? (size_t)counts[lane] : 0;
+				}
+			}
+		}
+
+		/* Any trials left in the run rolled no dice. */
+		for (; lane < end; lane++)
+			counts[lane] = 0;
+	}
+}
+
+
+
 /* Returns a random number between 1 and max. */
-/* This is rather arcane, but it spreads bias where max is not a factor of
- * RAND_MAX throughout the range between 1 and max, rather than placing it
- * all at the upper end. */
+/* This uses Lemire's multiply-shift method; the top 32 bits of a random word
+ * are multiplied by max, and the high half of the product is the result. The
+ * few low halves which would make some results more likely than others are
+ * rejected and redrawn, so every face is exactly equally likely. */
 unsigned int RollEngine::Random(unsigned int max)
 {
-	double divisor = RAND_MAX + 1.0;
-	unsigned int result = (unsigned int)(1.0 + (double)rand_r(&seed) * ((double) max / divisor));
-	return result;
+	/* A zero-sided die has always come up 1. */
+	if (max == 0)
+		return 1;
+
+	uint64_t product = (generator->Next() >> 32) * max;
+	uint32_t low = (uint32_t)product;
+	if (low < max)
+	{
+		uint32_t threshold = (uint32_t)(-max) % max;
+		while (low < threshold)
+		{
+			product = (generator->Next() >> 32) * max;
+			low = (uint32_t)product;
+		}
+	}
+	return (unsigned int)(product >> 32) + 1;
+}
+
+
+
+/* The number of times in a row a die comes up on its highest face is
+ * geometrically distributed, so it is drawn at once by inverting the
+ * distribution: the chance of at least n is (1/sides)^n, which is the chance
+ * of a uniform number being at most that. The face ending the chain is then
+ * equally likely to be any of the others. */
+unsigned int RollEngine::RollExplosions(unsigned int sides, unsigned int cap, unsigned int& last)
+{
+	/* A die with one side would never stop exploding. */
+	if (sides < 2)
+	{
+		last = 0;
+		return cap;
+	}
+
+	double explosions = ::floor(::log(Uniform()) / ::log(1.0 / sides));
+	if (explosions >= cap)
+	{
+		last = 0;
+		return cap;
+	}
+
+	last = Random(sides - 1);
+	return (unsigned int)explosions;
+}
+
+
+
+void RollEngine::AppendExplosionChain(unsigned int sides, unsigned int explosions, unsigned int last)
+{
+	AppendText("(");
+	for (unsigned int i = 0; i < explosions; i++)
+	{
+		AppendInteger(sides);
+		AppendText(",");
+	}
+	AppendInteger(last);
+	AppendText(")");
 }
 
 
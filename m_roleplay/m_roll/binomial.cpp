@@ -0,0 +1,150 @@
+/* RollEngine binomial sampling, used to roll dice pools in summary. */
+#include "rollengine.h"
+
+/* Binomial draws with a mean below this use inversion; larger ones use
+ * transformed rejection. */
+#define BINOMIAL_INVERSION_MEAN 10
+
+
+
+/* Return ln(k!). Small values are summed directly; larger ones use the
+ * Stirling series for ln(gamma(k + 1)), which is accurate to double precision
+ * from there up. */
+static double LogFactorial(double k)
+{
+	if (k < 16)
+	{
+		double total = 0;
+		for (double i = 2; i <= k; i++)
+			total += ::log(i);
+		return total;
+	}
+
+	double x = k + 1;
+	double x2 = x * x;
+	return (x - 0.5) * ::log(x) - x + 0.5 * ::log(2 * M_PI) + (1.0 / 12 - (1.0 / 360 - 1.0 / (1260 * x2)) / x2) / x;
+}
+
+
+
+/* Returns a random number strictly between 0 and 1, with 53 bits of
+ * precision. */
+double RollEngine::Uniform()
+{
+	return ((generator->Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+
+
+/* Returns the number of successes in count trials with the given chance of
+ * success each, drawn exactly from the binomial distribution. This takes
+ * expected constant time; small means walk the distribution from zero, and
+ * everything else uses Hormann's BTRS transformed rejection sampler. */
+unsigned int RollEngine::Binomial(unsigned int count, double chance)
+{
+	if (count == 0 || chance <= 0)
+		return 0;
+	if (chance >= 1)
+		return count;
+
+	/* Both methods want the chance of success to be at most one half. */
+	if (chance > 0.5)
+		return count - Binomial(count, 1 - chance);
+
+	double n = count;
+	double p = chance;
+	double q = 1 - p;
+
+	if (n * p < BINOMIAL_INVERSION_MEAN)
+	{
+		/* Walk up the distribution from zero until the uniform value is
+		 * used up. The bound guards against rounding error running the
+		 * walk off the end; it is far enough out never to matter. */
+		double s = p / q;
+		double a = (n + 1) * s;
+		double bound = std::min(n, n * p + 10 * ::sqrt(n * p * q + 1));
+		while (1)
+		{
+			double r = ::pow(q, n);
+			double u = Uniform();
+			unsigned int k = 0;
+			while (u > r)
+			{
+				u -= r;
+				k++;
+				if (k > bound)
+					break;
+				r *= a / k - s;
+			}
+			if (k <= bound)
+				return k;
+		}
+	}
+
+	double spq = ::sqrt(n * p * q);
+	double b = 1.15 + 2.53 * spq;
+	double a = -0.0873 + 0.0248 * b + 0.01 * p;
+	double c = n * p + 0.5;
+	double vr = 0.92 - 4.2 / b;
+	double alpha = (2.83 + 5.1 / b) * spq;
+	double lpq = ::log(p / q);
+	double m = ::floor((n + 1) * p);
+	double h = LogFactorial(m) + LogFactorial(n - m);
+
+	while (1)
+	{
+		double u = Uniform() - 0.5;
+		double v = Uniform();
+		double us = 0.5 - ::fabs(u);
+		double k = ::floor((2 * a / us + b) * u + c);
+		if (k < 0 || k > n)
+			continue;
+
+		/* Most draws are accepted by the squeeze, without needing any
+		 * logarithms. */
+		if (us >= 0.07 && v <= vr)
+			return (unsigned int)k;
+
+		v = ::log(v * alpha / (a / (us * us) + b));
+		if (v <= h - LogFactorial(k) - LogFactorial(n - k) + (k - m) * lpq)
+			return (unsigned int)k;
+	}
+}
+
+
+
+/* Each face in turn takes its share of the dice not yet given to a lower
+ * face; conditioned on those, the count for the face is binomial. */
+void RollEngine::RollFaceCounts(unsigned int* faces, unsigned int count, unsigned int sides)
+{
+	unsigned int remaining = count;
+	faces[0] = 0;
+	for (unsigned int face = 1; face < sides; face++)
+	{
+		faces[face] = Binomial(remaining, 1.0 / (sides - face + 1));
+		remaining -= faces[face];
+	}
+	faces[sides] = remaining;
+
+	if (recording)
+		results->AddFaceCounts(faces, sides);
+}
+
+
+
+/* Add a result line listing how many dice showed each face. */
+void RollEngine::AddFaceCounts(const unsigned int* faces, unsigned int sides)
+{
+	BeginLine("<Faces:");
+	for (unsigned int face = 1; face <= sides; face++)
+	{
+		AppendText(" ");
+		AppendInteger(face);
+		AppendText(": ");
+		AppendInteger(faces[face]);
+		if (face != sides)
+			AppendText(",");
+	}
+	AppendText(">");
+	results->AddMsg(resultline);
+}
@@ -0,0 +1,226 @@
+/* RollEngine bulk dice rolling kernels. */
+#include "rollengine.h"
+
+/* The vectorised kernels are only built for x86 with a GCC-compatible
+ * compiler, which lets us enable instruction sets per function and pick
+ * between them at runtime. Everything else uses the scalar kernels. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROLL_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Number of dice mapped per pass; the random words for a pass live on the
+ * stack, two dice to a word. */
+#define DICE_CHUNK 512
+
+
+
+/* Kernel types. A map kernel turns random 32-bit values (two per word, low
+ * half first) into die faces between 1 and sides, writing a zero face for any
+ * value that must be rejected to keep faces unbiased, and returns whether it
+ * did so. A sum kernel totals a buffer of faces. */
+typedef bool (*DiceMapKernel)(uint32_t* faces, const uint64_t* words, size_t count, uint32_t sides, uint32_t threshold);
+typedef uint64_t (*DiceSumKernel)(const uint32_t* faces, size_t count);
+
+
+
+static bool MapDiceScalar(uint32_t* faces, const uint64_t* words, size_t count, uint32_t sides, uint32_t threshold)
+{
+	bool rejected = false;
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t random = (i & 1) ? (uint32_t)(words[i / 2] >> 32) : (uint32_t)words[i / 2];
+		uint64_t product = (uint64_t)random * sides;
+		if ((uint32_t)product < threshold)
+		{
+			faces[i] = 0;
+			rejected = true;
+		}
+		else
+			faces[i] = (uint32_t)(product >> 32) + 1;
+	}
+	return rejected;
+}
+
+
+
+static uint64_t SumDiceScalar(const uint32_t* faces, size_t count)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; i++)
+		total += faces[i];
+	return total;
+}
+
+
+
+#ifdef ROLL_SIMD_X86
+/* Both vector kernels multiply the even and odd 32-bit lanes separately,
+ * producing 64-bit products, then blend the high halves back together for the
+ * faces and the low halves for the rejection test. There is no unsigned
+ * compare, so low >= threshold is tested as max(low, threshold) == low. */
+__attribute__((target("sse4.1")))
+static bool MapDiceSSE41(uint32_t* faces, const uint64_t* words, size_t count, uint32_t sides, uint32_t threshold)
+{
+	const __m128i vsides = _mm_set1_epi32(sides);
+	const __m128i vthreshold = _mm_set1_epi32(threshold);
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i allok = _mm_set1_epi32(-1);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i random = _mm_loadu_si128((const __m128i*)(words + i / 2));
+		__m128i even = _mm_mul_epu32(random, vsides);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(random, 32), vsides);
+		__m128i high = _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC);
+		__m128i low = _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xCC);
+		__m128i ok = _mm_cmpeq_epi32(_mm_max_epu32(low, vthreshold), low);
+		_mm_storeu_si128((__m128i*)(faces + i), _mm_and_si128(_mm_add_epi32(high, one), ok));
+		allok = _mm_and_si128(allok, ok);
+	}
+
+	bool rejected = _mm_movemask_epi8(allok) != 0xFFFF;
+	if (i < count)
+		rejected |= MapDiceScalar(faces + i, words + i / 2, count - i, sides, threshold);
+	return rejected;
+}
+
+
+
+__attribute__((target("sse4.1")))
+static uint64_t SumDiceSSE41(const uint32_t* faces, size_t count)
+{
+	__m128i total = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(faces + i));
+		total = _mm_add_epi64(total, _mm_cvtepu32_epi64(block));
+		total = _mm_add_epi64(total, _mm_cvtepu32_epi64(_mm_srli_si128(block, 8)));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, total);
+	return lanes[0] + lanes[1] + SumDiceScalar(faces + i, count - i);
+}
+
+
+
+__attribute__((target("avx2")))
+static bool MapDiceAVX2(uint32_t* faces, const uint64_t* words, size_t count, uint32_t sides, uint32_t threshold)
+{
+	const __m256i vsides = _mm256_set1_epi32(sides);
+	const __m256i vthreshold = _mm256_set1_epi32(threshold);
+	const __m256i one = _mm256_set1_epi32(1);
+	__m256i allok = _mm256_set1_epi32(-1);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i random = _mm256_loadu_si256((const __m256i*)(words + i / 2));
+		__m256i even = _mm256_mul_epu32(random, vsides);
+		__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(random, 32), vsides);
+		__m256i high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+		__m256i low = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+		__m256i ok = _mm256_cmpeq_epi32(_mm256_max_epu32(low, vthreshold), low);
+		_mm256_storeu_si256((__m256i*)(faces + i), _mm256_and_si256(_mm256_add_epi32(high, one), ok));
+		allok = _mm256_and_si256(allok, ok);
+	}
+
+	bool rejected = _mm256_movemask_epi8(allok) != -1;
+	if (i < count)
+		rejected |= MapDiceScalar(faces + i, words + i / 2, count - i, sides, threshold);
+	return rejected;
+}
+
+
+
+__attribute__((target("avx2")))
+static uint64_t SumDiceAVX2(const uint32_t* faces, size_t count)
+{
+	__m256i total = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(faces + i));
+		total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(block)));
+		total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(block, 1)));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, total);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumDiceScalar(faces + i, count - i);
+}
+#endif
+
+
+
+/* The kernels in use. These start as the scalar kernels, and are replaced by
+ * SelectDiceKernels() while the program or module is loaded, before any
+ * thread which could roll dice is started, so they are never written while
+ * being read. */
+static DiceMapKernel MapDice = MapDiceScalar;
+static DiceSumKernel SumDiceKernel = SumDiceScalar;
+
+static bool SelectDiceKernels()
+{
+#ifdef ROLL_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		MapDice = MapDiceAVX2;
+		SumDiceKernel = SumDiceAVX2;
+	}
+	else if (__builtin_cpu_supports("sse4.1"))
+	{
+		MapDice = MapDiceSSE41;
+		SumDiceKernel = SumDiceSSE41;
+	}
+#endif
+	return true;
+}
+
+static const bool DiceKernelsSelected = SelectDiceKernels();
+
+
+
+/* Roll count dice with the given number of sides into faces. Unlike
+ * RollTheBones, this performs no checks; as with Random(), zero-sided dice
+ * come up 1, which is what sides that aren't a number end up as. */
+void RollEngine::RollDice(uint32_t* faces, size_t count, unsigned int sides)
+{
+	if (sides == 0)
+	{
+		std::fill(faces, faces + count, 1U);
+		return;
+	}
+
+	/* See Random() for the reasoning behind the threshold. */
+	uint32_t threshold = (uint32_t)(-sides) % sides;
+	uint64_t words[DICE_CHUNK / 2];
+
+	for (size_t done = 0; done < count; done += DICE_CHUNK)
+	{
+		size_t chunk = std::min((size_t)DICE_CHUNK, count - done);
+		generator->Fill(words, (chunk + 1) / 2);
+
+		/* Rejections are rare enough (under one in 400000 for any die
+		 * we allow) that they are simply rerolled one at a time. */
+		if (MapDice(faces + done, words, chunk, sides, threshold))
+		{
+			for (size_t i = done; i < done + chunk; i++)
+				if (!faces[i])
+					faces[i] = Random(sides);
+		}
+	}
+}
+
+
+
+uint64_t RollEngine::SumDice(const uint32_t* faces, size_t count)
+{
+	return SumDiceKernel(faces, count);
+}
@@ -0,0 +1,79 @@
+/* RollEngine's dice rolls with modifiers, for expressions. */
+#include "rollengine.h"
+
+
+
+double RollEngine::RollModifiedDice(double count, double sides, const ExpDiceModifiers& modifiers)
+{
+	CheckDice(count, sides);
+
+	/* As in RollTheBones(), counts which aren't a number roll no dice. */
+	size_t dice = count > 0 ? (size_t)count : 0;
+	unsigned int die = (unsigned int)sides;
+	if (modifiedfaces.size() < dice)
+		modifiedfaces.resize(dice);
+	uint32_t* faces = dice ? &modifiedfaces[0] : NULL;
+
+	/* Rerolling faces until they are higher than the reroll number is
+	 * the same as rolling the faces above it to begin with. A die can't
+	 * reroll its highest face. */
+	unsigned int rerolled = std::min(modifiers.reroll, die ? die - 1 : 0);
+	RollDice(faces, dice, die - rerolled);
+	if (rerolled)
+	{
+		for (size_t i = 0; i < dice; i++)
+			faces[i] += rerolled;
+	}
+
+	/* Each die on its highest face rolls again, for as long as it comes
+	 * up highest; see RollExplosions(). Each die is recorded with the
+	 * total of its whole chain, so the faces add up to the roll. */
+	if (modifiers.explode)
+	{
+		for (size_t i = 0; i < dice; i++)
+		{
+			if (faces[i] == die)
+			{
+				unsigned int last;
+				unsigned int explosions = RollExplosions(die, MAX_DICE_EXPLOSIONS, last);
+				faces[i] += die * explosions + last;
+			}
+		}
+	}
+	RecordDice(faces, dice, die);
+
+	/* Keep only the selected dice. Partitioning the faces around the
+	 * first kept one is enough to split them; the order within the kept
+	 * and dropped dice doesn't matter. */
+	uint32_t* kept = faces;
+	size_t keeping = dice;
+	if (modifiers.selection)
+	{
+		size_t selected = std::min((size_t)modifiers.select, dice);
+		if (modifiers.selection == KEEP_HIGHEST || modifiers.selection == KEEP_LOWEST)
+			keeping = selected;
+		else
+			keeping = dice - selected;
+
+		if (modifiers.selection == KEEP_HIGHEST || modifiers.selection == DROP_LOWEST)
+		{
+			kept = faces + dice - keeping;
+			std::nth_element(faces, kept, faces + dice);
+		}
+		else
+			std::nth_element(faces, faces + keeping, faces + dice);
+	}
+
+	/* Count the kept dice reaching the success number, or total them. */
+	if (modifiers.success)
+	{
+		size_t successes = 0;
+		for (size_t i = 0; i < keeping; i++)
+		{
+			if (kept[i] >= modifiers.success)
+				successes++;
+		}
+		return (double)successes;
+	}
+	return (double)SumDice(kept, keeping);
+}
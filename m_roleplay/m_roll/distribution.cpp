@@ -0,0 +1,243 @@
+/* RollEngine probability distribution functions. */
+#include "rollengine.h"
+
+#include <complex>
+
+typedef std::complex<double> Complex;
+
+
+
+/* In-place iterative radix-2 FFT. The size of data must be a power of two.
+ * The inverse transform is left unscaled. */
+static void FFT(std::vector<Complex>& data, bool inverse)
+{
+	size_t size = data.size();
+
+	/* Reorder into bit-reversed index order. */
+	for (size_t i = 1, j = 0; i < size; i++)
+	{
+		size_t bit = size >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(data[i], data[j]);
+	}
+
+	/* Combine butterflies of doubling length. */
+	for (size_t length = 2; length <= size; length <<= 1)
+	{
+		double angle = 2 * M_PI / length * (inverse ? 1 : -1);
+		Complex step(::cos(angle), ::sin(angle));
+		for (size_t start = 0; start < size; start += length)
+		{
+			Complex w(1);
+			for (size_t i = 0; i < length / 2; i++)
+			{
+				Complex even = data[start + i];
+				Complex odd = data[start + i + length / 2] * w;
+				data[start + i] = even + odd;
+				data[start + i + length / 2] = even - odd;
+				w *= step;
+			}
+		}
+	}
+}
+
+
+
+void Distribution::SetConstant(int64_t value)
+{
+	offset = value;
+	probability.assign(1, 1.0);
+}
+
+
+
+void Distribution::SetDie(unsigned int sides)
+{
+	offset = 1;
+	probability.assign(sides, 1.0 / sides);
+}
+
+
+
+double Distribution::Mean() const
+{
+	double mean = 0;
+	for (size_t i = 0; i < probability.size(); i++)
+		mean += probability[i] * (double)i;
+	return mean + offset;
+}
+
+
+
+double Distribution::Variance() const
+{
+	double mean = Mean() - offset;
+	double variance = 0;
+	for (size_t i = 0; i < probability.size(); i++)
+		variance += probability[i] * ((double)i - mean) * ((double)i - mean);
+	return variance;
+}
+
+
+
+int64_t Distribution::Percentile(double fraction) const
+{
+	double cumulative = 0;
+	for (size_t i = 0; i < probability.size(); i++)
+	{
+		cumulative += probability[i];
+		if (cumulative >= fraction - 1e-12)
+			return offset + (int64_t)i;
+	}
+	return Maximum();
+}
+
+
+
+double Distribution::AtLeast(double value) const
+{
+	double total = 0;
+	for (size_t i = probability.size(); i > 0; i--)
+	{
+		if (offset + (int64_t)(i - 1) < value)
+			break;
+		total += probability[i - 1];
+	}
+	return std::min(total, 1.0);
+}
+
+
+
+/* Adding two independent results convolves their distributions. Small
+ * convolutions are done directly; large ones go through an FFT, which makes
+ * rolls like 1000d100 cost O(n log n) rather than O(n^2). */
+bool Distribution::Add(const Distribution& a, const Distribution& b, Distribution& result)
+{
+	size_t size = a.probability.size() + b.probability.size() - 1;
+	if (size > MAX_DIST_VALUES)
+		return false;
+
+	result.offset = a.offset + b.offset;
+
+	if (std::min(a.probability.size(), b.probability.size()) < MIN_FFT_SIZE)
+	{
+		result.probability.assign(size, 0.0);
+		for (size_t i = 0; i < a.probability.size(); i++)
+			for (size_t j = 0; j < b.probability.size(); j++)
+				result.probability[i + j] += a.probability[i] * b.probability[j];
+		return true;
+	}
+
+	size_t fftsize = 1;
+	while (fftsize < size)
+		fftsize <<= 1;
+
+	std::vector<Complex> fa(fftsize), fb(fftsize);
+	std::copy(a.probability.begin(), a.probability.end(), fa.begin());
+	std::copy(b.probability.begin(), b.probability.end(), fb.begin());
+	FFT(fa, false);
+	FFT(fb, false);
+	for (size_t i = 0; i < fftsize; i++)
+		fa[i] *= fb[i];
+	FFT(fa, true);
+
+	/* Rounding error can leave tiny negative probabilities; clamp them. */
+	result.probability.resize(size);
+	for (size_t i = 0; i < size; i++)
+		result.probability[i] = std::max(fa[i].real() / fftsize, 0.0);
+	return true;
+}
+
+
+
+/* Multiplying results has no fast general form, so every pair of outcomes is
+ * combined directly. This is only cheap when at least one side is small,
+ * which covers the usual case of scaling a roll by a constant. */
+bool Distribution::Multiply(const Distribution& a, const Distribution& b, Distribution& result)
+{
+	/* Work out the range in floating point first, so huge values are
+	 * rejected rather than overflowing. */
+	double corners[4] = {
+		(double)a.Minimum() * b.Minimum(), (double)a.Minimum() * b.Maximum(),
+		(double)a.Maximum() * b.Minimum(), (double)a.Maximum() * b.Maximum()
+	};
+	double lowest = *std::min_element(corners, corners + 4);
+	double highest = *std::max_element(corners, corners + 4);
+	if (highest - lowest + 1 > MAX_DIST_VALUES || fabs(lowest) > 1e15 || fabs(highest) > 1e15)
+		return false;
+	if ((double)a.probability.size() * b.probability.size() > MAX_DIST_VALUES * 16.0)
+		return false;
+
+	int64_t low = (int64_t)lowest;
+	int64_t high = (int64_t)highest;
+
+	result.offset = low;
+	result.probability.assign(high - low + 1, 0.0);
+	for (size_t i = 0; i < a.probability.size(); i++)
+	{
+		if (a.probability[i] == 0)
+			continue;
+		for (size_t j = 0; j < b.probability.size(); j++)
+			result.probability[(a.offset + (int64_t)i) * (b.offset + (int64_t)j) - low] += a.probability[i] * b.probability[j];
+	}
+	return true;
+}
+
+
+
+void Distribution::AddDie(unsigned int sides)
+{
+	/* Each new probability is the mean of the sides old ones that can
+	 * reach it, which running sums give in one pass. */
+	size_t size = probability.size();
+	std::vector<double> sums(size + 1, 0.0);
+	for (size_t i = 0; i < size; i++)
+		sums[i + 1] = sums[i] + probability[i];
+
+	probability.resize(size + sides - 1);
+	for (size_t i = 0; i < probability.size(); i++)
+	{
+		size_t high = std::min(i + 1, size);
+		size_t low = i + 1 > sides ? i + 1 - sides : 0;
+		probability[i] = (sums[high] - sums[low]) / sides;
+	}
+	offset++;
+}
+
+
+
+void Distribution::Negate()
+{
+	offset = -Maximum();
+	std::reverse(probability.begin(), probability.end());
+}
+
+
+
+void Distribution::Mix(const Distribution& other, double weight)
+{
+	/* Mixing into an empty distribution just takes on the other one. */
+	if (probability.empty())
+	{
+		offset = other.offset;
+		probability.resize(other.probability.size());
+		for (size_t i = 0; i < other.probability.size(); i++)
+			probability[i] = other.probability[i] * weight;
+		return;
+	}
+
+	int64_t low = std::min(Minimum(), other.Minimum());
+	int64_t high = std::max(Maximum(), other.Maximum());
+
+	/* Widen this distribution to cover both ranges. */
+	if (low < offset)
+		probability.insert(probability.begin(), offset - low, 0.0);
+	probability.resize(high - low + 1, 0.0);
+	offset = low;
+
+	for (size_t i = 0; i < other.probability.size(); i++)
+		probability[other.offset - low + i] += other.probability[i] * weight;
+}
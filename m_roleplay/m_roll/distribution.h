@@ -0,0 +1,77 @@
+/* RollEngine probability distribution header file. */
+#ifndef __DISTRIBUTION_H__
+#define __DISTRIBUTION_H__
+
+#include <stdint.h>
+
+#include <vector>
+
+/* The defined limits used in calculating distributions. */
+#define MAX_DIST_VALUES 1048576 /* Maximum possible outcomes in one distribution. */
+#define MAX_DIST_CACHE 64       /* Maximum dice distributions remembered. */
+#define MAX_DIST_WORK 67108864  /* Maximum work building dice for varying counts. */
+#define MIN_FFT_SIZE 64         /* Smallest distribution convolved with an FFT. */
+
+
+/* Distribution class. */
+/* The exact probability distribution of an integer result, stored densely as
+ * the probability of each value from offset upwards. Distributions are built
+ * up by evaluating an expression over them instead of over numbers; see
+ * ExpressionParser::EvalDistribution(). */
+class Distribution
+{
+ public:
+	/* The value the first probability is for. */
+	int64_t offset;
+
+	/* The probability of each value, from offset upwards. */
+	std::vector<double> probability;
+
+	/* Construct a distribution certain to produce zero. */
+	Distribution() : offset(0), probability(1, 1.0) { }
+
+	/* Set this to a distribution certain to produce the given value. */
+	void SetConstant(int64_t value);
+
+	/* Set this to the distribution of a single die with the given sides. */
+	void SetDie(unsigned int sides);
+
+	/* Whether this distribution can only produce one value. */
+	bool IsConstant() const { return probability.size() == 1; }
+
+	/* The lowest and highest values this distribution can produce. */
+	int64_t Minimum() const { return offset; }
+	int64_t Maximum() const { return offset + (int64_t)probability.size() - 1; }
+
+	/* Statistics about the distribution. */
+	double Mean() const;
+	double Variance() const;
+
+	/* Return the lowest value the result is at or below with at least the
+	 * given probability. */
+	int64_t Percentile(double fraction) const;
+
+	/* Return the probability of the result being at least the given
+	 * value. */
+	double AtLeast(double value) const;
+
+	/* Operations combining distributions. Each returns false without
+	 * changing the result if it would exceed MAX_DIST_VALUES. The result
+	 * must not be either of the inputs. */
+	static bool Add(const Distribution& a, const Distribution& b, Distribution& result);
+	static bool Multiply(const Distribution& a, const Distribution& b, Distribution& result);
+
+	/* Add one die with the given sides to this distribution in place, in
+	 * time proportional to its size. */
+	void AddDie(unsigned int sides);
+
+	/* Negate this distribution in place. */
+	void Negate();
+
+	/* Add other weighted by the given probability to this distribution.
+	 * An empty distribution (with no probabilities) may be mixed into to
+	 * start a mixture. */
+	void Mix(const Distribution& other, double weight);
+};
+
+#endif
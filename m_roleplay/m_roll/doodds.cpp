@@ -0,0 +1,332 @@
+/* RollEngine's ODDS-type roll handling. */
+#include "rollengine.h"
+
+
+
+void RollEngine::DoOdds()
+{
+	results->preset = PRESET_ODDS;
+
+	/* The rest of the parameters are an optional message to be displayed
+	 * with the roll; put them together for such. */
+	std::string message;
+	for (size_t i = 2; i < roll->expression.size(); i++)
+		message += " " + roll->expression[i];
+
+	/* Work out the distribution. The special RPG expressions handled by
+	 * ReadExpression are all equivalent to a 1d100. */
+	const std::string& expression_string = roll->expression[0];
+	Distribution odds;
+	if (expression_string == "%" || !strcasecmp(expression_string.c_str(), "d%HL") || !strcasecmp(expression_string.c_str(), "%HL"))
+		odds.SetDie(100);
+	else
+	{
+		if (!expression->Parse(expression_string.c_str()) || !expression->EvalDistribution(odds))
+			return;
+	}
+
+	/* Add the summary of the distribution. */
+	std::string line = "<Odds" + For() + " [" + expression_string + "]: Mean: " + Str(odds.Mean());
+	line += ", Variance: " + Str(odds.Variance());
+	line += ", Range: " + Str(odds.Minimum());
+	line += " to " + Str(odds.Maximum()) + ">" + message;
+	results->AddMsg(line);
+
+	line = "<Percentiles: 5%: " + Str(odds.Percentile(0.05));
+	line += ", 25%: " + Str(odds.Percentile(0.25));
+	line += ", 50%: " + Str(odds.Percentile(0.5));
+	line += ", 75%: " + Str(odds.Percentile(0.75));
+	line += ", 95%: " + Str(odds.Percentile(0.95)) + ">";
+	results->AddMsg(line);
+
+	/* Add the chance of meeting the target, if one is provided. */
+	if (roll->expression.size() >= 2)
+	{
+		double target;
+		if (!ReadExpression(roll->expression[1], target))
+			return;
+		line = "<Chance of at least " + Str(target, roll->expression[1]);
+		line += ": " + Str(::round(odds.AtLeast(target) * 10000) / 100) + "%>";
+		results->AddMsg(line);
+	}
+}
+
+
+
+/* Return the distribution of a roll of count dice with the given sides,
+ * which must already have been through CheckDice(). These are remembered, so
+ * repeated queries for common rolls are just a lookup. */
+const Distribution* RollEngine::DiceDistribution(unsigned int count, unsigned int sides)
+{
+	std::pair<unsigned int, unsigned int> key(count, sides);
+	std::map<std::pair<unsigned int, unsigned int>, Distribution>::iterator cached = dicedistributions.find(key);
+	if (cached != dicedistributions.end())
+		return &cached->second;
+
+	/* Build the distribution by repeated doubling; with the FFT, this
+	 * takes O(n log^2 n) rather than the O(n^2) of adding one die at a
+	 * time. */
+	Distribution result, power, scratch;
+	result.SetConstant(0);
+	power.SetDie(sides);
+	for (unsigned int remaining = count; remaining; remaining >>= 1)
+	{
+		if (remaining & 1)
+		{
+			if (!Distribution::Add(result, power, scratch))
+			{
+				OddsError("Error: The expression has too many possible results to calculate the odds for.");
+				return NULL;
+			}
+			result.probability.swap(scratch.probability);
+			result.offset = scratch.offset;
+		}
+		if (remaining > 1)
+		{
+			if (!Distribution::Add(power, power, scratch))
+			{
+				OddsError("Error: The expression has too many possible results to calculate the odds for.");
+				return NULL;
+			}
+			power.probability.swap(scratch.probability);
+			power.offset = scratch.offset;
+		}
+	}
+
+	/* Forget everything once the cache is full; the common rolls will be
+	 * back soon enough. */
+	if (dicedistributions.size() >= MAX_DIST_CACHE)
+		dicedistributions.clear();
+
+	Distribution& stored = dicedistributions[key];
+	stored.offset = result.offset;
+	stored.probability.swap(result.probability);
+	return &stored;
+}
+
+
+
+bool RollEngine::OddsError(const std::string& message)
+{
+	results->Clear();
+	results->AddError(message);
+	return false;
+}
+
+
+
+/* A value on the stack while evaluating a distribution. Constants are kept as
+ * plain numbers, so any operator or function can be applied to them exactly
+ * as Eval() would; only values involving dice become distributions. */
+class OddsValue
+{
+ public:
+	bool constant;
+	double value;
+	Distribution distribution;
+
+	OddsValue() : constant(true), value(0) { }
+};
+
+
+
+/* Turn a constant value into a distribution. Only whole numbers have one. */
+static bool MakeDistribution(OddsValue& operand)
+{
+	if (!operand.constant)
+		return true;
+	if (::round(operand.value) != operand.value || fabs(operand.value) > 1e15)
+		return false;
+
+	operand.distribution.SetConstant((int64_t)operand.value);
+	operand.constant = false;
+	return true;
+}
+
+
+
+/* Whether a number is finite; neither infinite, nor not a number. */
+static bool IsFinite(double number)
+{
+	return fabs(number) <= std::numeric_limits<double>::max();
+}
+
+
+
+bool ExpressionParser::EvalDistribution(Distribution& result)
+{
+	std::vector<OddsValue> stack(1);
+	Distribution scratch;
+	size_t top = 0;
+
+	for (size_t i = 0; i < ProgramLength; ++i)
+	{
+		ExpTokenType type = Program[i].token.type;
+
+		if (type == NUMBER)
+		{
+			top++;
+			if (top >= stack.size())
+				stack.resize(top + 1);
+			stack[top].constant = true;
+			stack[top].value = Program[i].number.value;
+			continue;
+		}
+
+		/* Unary operators and functions. ran() is a die in disguise. */
+		OddsValue& last = stack[top];
+		if (type == RANDOM)
+		{
+			if (!last.constant)
+				return engine->OddsError("Error: Odds can only be calculated for functions of fixed values.");
+			if (!(last.value > -1 && last.value < MAX_DIST_VALUES))
+				return engine->OddsError("Error: The expression has too many possible results to calculate the odds for.");
+			last.distribution.SetDie(std::max((unsigned int)last.value, 1U));
+			last.constant = false;
+			continue;
+		}
+		if (type == UMINUS || type == FUNCTION)
+		{
+			if (last.constant)
+			{
+				if (type == UMINUS)
+					last.value = -last.value;
+				else
+					last.value = Program[i].function.pointer(last.value);
+			}
+			else if (type == UMINUS)
+				last.distribution.Negate();
+			else
+				return engine->OddsError("Error: Odds can only be calculated for functions of fixed values.");
+			continue;
+		}
+
+		/* Binary operators. */
+		OddsValue& left = stack[top - 1];
+		OddsValue& right = last;
+		top--;
+
+		if (type == DICE)
+		{
+			if (Program[i].dice.modifiers.Any())
+				return engine->OddsError("Error: Odds can't be calculated for dice with modifiers.");
+			if (!right.constant)
+				return engine->OddsError("Error: Odds can only be calculated for dice with a fixed number of sides.");
+
+			/* CheckDice() leaves numbers of dice and sides which
+			 * aren't a number as they are, and they can't be made
+			 * whole numbers of dice, so these, and infinite ones,
+			 * are turned away. Variable counts are always finite. */
+			if (!IsFinite(right.value) || (left.constant && !IsFinite(left.value)))
+				return engine->OddsError("Error: Odds can only be calculated for dice with a finite number of dice and sides.");
+
+			/* A fixed number of dice is a single lookup; a variable
+			 * number mixes the distributions for each possible
+			 * count. */
+			double sides = right.value;
+			if (left.constant)
+			{
+				double count = left.value;
+				engine->CheckDice(count, sides);
+				const Distribution* dice = engine->DiceDistribution((unsigned int)count, (unsigned int)sides);
+				if (!dice)
+					return false;
+				left.distribution.offset = dice->offset;
+				left.distribution.probability = dice->probability;
+			}
+			else
+			{
+				/* The dice for each count are usually a few more dice
+				 * than for the count before, so build them up a die at
+				 * a time, only starting afresh for big jumps, such as
+				 * from the 10000 dice CheckDice() turns negative counts
+				 * into. That takes time in proportion to the square of
+				 * the highest count, so give up early if that's too
+				 * long. */
+				double highest = std::min(std::max((double)left.distribution.Maximum(), 0.0), 10000.0);
+				if (highest * highest * std::min(std::max(sides, 1.0), 10000.0) > MAX_DIST_WORK)
+					return engine->OddsError("Error: The expression has too many possible results to calculate the odds for.");
+
+				Distribution counts;
+				counts.offset = left.distribution.offset;
+				counts.probability.swap(left.distribution.probability);
+				left.distribution.probability.clear();
+
+				Distribution dice;
+				double dicecount = 0;
+				for (size_t n = 0; n < counts.probability.size(); n++)
+				{
+					if (counts.probability[n] == 0)
+						continue;
+					double count = (double)(counts.offset + (int64_t)n);
+					double dicesides = sides;
+					engine->CheckDice(count, dicesides);
+					if (count < dicecount || count > dicecount + MIN_FFT_SIZE)
+					{
+						const Distribution* start = engine->DiceDistribution((unsigned int)count, (unsigned int)dicesides);
+						if (!start)
+							return false;
+						dice.offset = start->offset;
+						dice.probability = start->probability;
+						dicecount = count;
+					}
+					for (; dicecount < count; dicecount++)
+						dice.AddDie((unsigned int)dicesides);
+
+					left.distribution.Mix(dice, counts.probability[n]);
+					if (left.distribution.probability.size() > MAX_DIST_VALUES)
+						return engine->OddsError("Error: The expression has too many possible results to calculate the odds for.");
+				}
+			}
+			left.constant = false;
+			continue;
+		}
+
+		/* Operators on two constants are evaluated just as Eval() does. */
+		if (left.constant && right.constant)
+		{
+			if (type == ADD)
+				left.value += right.value;
+			else if (type == SUBTRACT)
+				left.value -= right.value;
+			else if (type == MULTIPLY)
+				left.value *= right.value;
+			else if (type == DIVIDE)
+				left.value /= right.value;
+			else if (type == MODULO)
+				left.value = ExpModulo(left.value, right.value);
+			else if (type == EXPONENT)
+				left.value = pow(left.value, right.value);
+			continue;
+		}
+
+		/* Only addition, subtraction and multiplication are supported for
+		 * results involving dice. */
+		if (type != ADD && type != SUBTRACT && type != MULTIPLY)
+			return engine->OddsError("Error: Odds can only be calculated for addition, subtraction and multiplication of dice rolls.");
+		if (!MakeDistribution(left) || !MakeDistribution(right))
+			return engine->OddsError("Error: Odds can only be calculated for whole numbers added to or multiplied with dice rolls.");
+
+		if (type == SUBTRACT)
+			right.distribution.Negate();
+
+		bool fits;
+		if (type == MULTIPLY)
+			fits = Distribution::Multiply(left.distribution, right.distribution, scratch);
+		else
+			fits = Distribution::Add(left.distribution, right.distribution, scratch);
+		if (!fits)
+			return engine->OddsError("Error: The expression has too many possible results to calculate the odds for.");
+
+		left.distribution.offset = scratch.offset;
+		left.distribution.probability.swap(scratch.probability);
+	}
+
+	/* A fixed result still has a distribution, if a dull one. */
+	if (!MakeDistribution(stack[top]))
+		return engine->OddsError("Error: Odds can only be calculated for expressions with whole number results.");
+
+	result.offset = stack[top].distribution.offset;
+	result.probability.swap(stack[top].distribution.probability);
+	return true;
+}
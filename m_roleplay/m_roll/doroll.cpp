@@ -5,102 +5,185 @@
 
 void RollEngine::DoRoll()
 {
-	std::vector<const char*> expr;
-	expr.resize(roll->expression.size());
-	for (size_t i = 0; i < roll->expression.size(); i++)
+	PresetFunction preset = FindPreset();
+	if (preset)
+	{
+		results->preset = PresetID(preset);
+		(this->*preset)();
+	}
+
+	else if (IsRepeatedExpression())
+		RollRepeatedExpression();
+
+	else
+		RollExpression();
+}
+
+
+
+RollEngine::PresetFunction RollEngine::FindPreset()
+{
+	/* No preset is named by more than three parameters; any missing are
+	 * left empty. */
+	size_t words = roll->expression.size();
+	const char* expr[3] = { "", "", "" };
+	for (size_t i = 0; i < words && i < 3; i++)
 		expr[i] = roll->expression[i].c_str();
 
 	if (!strcasecmp(expr[0], "craps"))
-		RollCraps();
+		return &RollEngine::RollCraps;
 
-	else if (expr.size() >= 2 && !strcasecmp(expr[0], "the") && !strcasecmp(expr[1], "dice"))
-		RollCraps();
+	else if (words >= 2 && !strcasecmp(expr[0], "the") && !strcasecmp(expr[1], "dice"))
+		return &RollEngine::RollCraps;
 
 	else if (!strcasecmp(expr[0], "dtwenty") || !strcasecmp(expr[0], "dt"))
-		RollD20();
+		return &RollEngine::RollD20;
 
 	else if (!strcasecmp(expr[0], "exalted") || !strcasecmp(expr[0], "exalt") || !strcasecmp(expr[0], "exal") || !strcasecmp(expr[0], "ex"))
-		RollExalted(1);
+		return &RollEngine::RollExalted1E;
 
 	else if (!strcasecmp(expr[0], "exalted2") || !strcasecmp(expr[0], "exalt2") || !strcasecmp(expr[0], "exal2") || !strcasecmp(expr[0], "ex2"))
-		RollExalted(0);
+		return &RollEngine::RollExalted2E;
 
 	else if (!strcasecmp(expr[0], "newhorizons") || !strcasecmp(expr[0], "nh") || !strcasecmp(expr[0], "horizons") || !strcasecmp(expr[0], "hz"))
-		RollNewHorizons();
+		return &RollEngine::RollNewHorizons;
 
 	else if (!strcasecmp(expr[0], "rtd"))
-		RollRTD();
+		return &RollEngine::RollRTD;
 
 	else if (!strcasecmp(expr[0], "shadowrun") || !strcasecmp(expr[0], "shadow") || !strcasecmp(expr[0], "shad"))
-		RollShadowrun();
+		return &RollEngine::RollShadowrun;
 
 	else if (!strcasecmp(expr[0], "wod"))
-		RollWOD();
+		return &RollEngine::RollWOD;
 		
 	else if (!strcasecmp(expr[0], "rwod"))
-		RollRWOD();
+		return &RollEngine::RollRWOD;
 
 	else if (!strcasecmp(expr[0], "nwod"))
-		RollNWOD();
+		return &RollEngine::RollNWOD;
 
 	else if (!strcasecmp(expr[0], "nwodc"))
-		RollNWODChance();
+		return &RollEngine::RollNWODChance;
 
 	else if (!strcasecmp(expr[0], "init"))
-		RollDND2EInit();
+		return &RollEngine::RollDND2EInit;
 
 	else if (!strcasecmp(expr[0], "attack") || !strcasecmp(expr[0], "hit") || !strcasecmp(expr[0], "check") || !strcasecmp(expr[0], "save"))
-		RollDNDAlias();
+		return &RollEngine::RollDNDAlias;
 
 	else if (!strcasecmp(expr[0], "barrel"))
-		RollEEBarrel();
+		return &RollEngine::RollEEBarrel;
 
-	else if ((expr.size() >= 3 && !strcasecmp(expr[0], "down") && !strcasecmp(expr[1], "the") && !strcasecmp(expr[2], "stairs")) || !strcasecmp(expr[0], "stairs"))
-		RollEEDownTheStairs();
+	else if ((words >= 3 && !strcasecmp(expr[0], "down") && !strcasecmp(expr[1], "the") && !strcasecmp(expr[2], "stairs")) || !strcasecmp(expr[0], "stairs"))
+		return &RollEngine::RollEEDownTheStairs;
 
-	else if ((expr.size() >= 3 && !strcasecmp(expr[0], "in") && !strcasecmp(expr[1], "the") && !strcasecmp(expr[2], "hay")) || !strcasecmp(expr[0], "hay"))
-		RollEEInTheHay();
+	else if ((words >= 3 && !strcasecmp(expr[0], "in") && !strcasecmp(expr[1], "the") && !strcasecmp(expr[2], "hay")) || !strcasecmp(expr[0], "hay"))
+		return &RollEngine::RollEEInTheHay;
 
 	else if (!strcasecmp(expr[0], "joint") || !strcasecmp(expr[0], "cigar"))
-		RollEEJoint();
+		return &RollEngine::RollEEJoint;
 
 	else if (!strcasecmp(expr[0], "fuzzfactor"))
-		RollEEJointFuzzFactor();
+		return &RollEngine::RollEEJointFuzzFactor;
 
 	else if (!strcasecmp(expr[0], "over"))
-		RollEEOver();
+		return &RollEngine::RollEEOver;
 
 	else if (!strcasecmp(expr[0], "rick"))
-		RollEERick();
+		return &RollEngine::RollEERick;
 
-	else if (expr.size() >= 2 && (!strcasecmp(expr[0], "your") || !strcasecmp(expr[0], "yo")) && (!strcasecmp(expr[1], "mom") || !strcasecmp(expr[1], "mum") || !strcasecmp(expr[1], "mother") || !strcasecmp(expr[1], "momma")))
-		RollEEYourMom();
+	else if (words >= 2 && (!strcasecmp(expr[0], "your") || !strcasecmp(expr[0], "yo")) && (!strcasecmp(expr[1], "mom") || !strcasecmp(expr[1], "mum") || !strcasecmp(expr[1], "mother") || !strcasecmp(expr[1], "momma")))
+		return &RollEngine::RollEEYourMom;
 
-	else if (expr.size() >= 2 && (!strcasecmp(expr[0], "your") || !strcasecmp(expr[0], "yo")) && (!strcasecmp(expr[1], "dad") || !strcasecmp(expr[1], "father") || !strcasecmp(expr[1], "dad")))
-		RollEEYourDad();
+	else if (words >= 2 && (!strcasecmp(expr[0], "your") || !strcasecmp(expr[0], "yo")) && (!strcasecmp(expr[1], "dad") || !strcasecmp(expr[1], "father") || !strcasecmp(expr[1], "dad")))
+		return &RollEngine::RollEEYourDad;
 
-	else if (strchr(expr[0], '[') && expr[0][strlen(expr[0])-1] == ']')
-		RollRepeatedExpression();
+	return NULL;
+}
 
-	else
-		RollExpression();
+
+
+RollPreset RollEngine::PresetID(PresetFunction function)
+{
+	static const struct
+	{
+		PresetFunction function;
+		RollPreset preset;
+	} presets[] = {
+		{ &RollEngine::RollCraps, PRESET_CRAPS },
+		{ &RollEngine::RollD20, PRESET_D20 },
+		{ &RollEngine::RollExalted1E, PRESET_EXALTED },
+		{ &RollEngine::RollExalted2E, PRESET_EXALTED2 },
+		{ &RollEngine::RollNewHorizons, PRESET_NEW_HORIZONS },
+		{ &RollEngine::RollRTD, PRESET_RTD },
+		{ &RollEngine::RollShadowrun, PRESET_SHADOWRUN },
+		{ &RollEngine::RollWOD, PRESET_WOD },
+		{ &RollEngine::RollRWOD, PRESET_RWOD },
+		{ &RollEngine::RollNWOD, PRESET_NWOD },
+		{ &RollEngine::RollNWODChance, PRESET_NWOD_CHANCE },
+		{ &RollEngine::RollDND2EInit, PRESET_DND2E_INIT },
+		{ &RollEngine::RollDNDAlias, PRESET_DND_ALIAS },
+	};
+
+	/* Every other preset is an easter egg. */
+	for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++)
+	{
+		if (presets[i].function == function)
+			return presets[i].preset;
+	}
+	return PRESET_EASTER_EGG;
 }
 
 
 
-void RollEngine::RollCraps()
+/* Repeated expressions are written as count[expression]. */
+bool RollEngine::IsRepeatedExpression()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
+	const std::string& expr = roll->expression[0];
+	return expr.find('[') != std::string::npos && expr[expr.size()-1] == ']';
+}
+
+
+
+void RollEngine::AddSuccesses(double successes)
+{
+	BeginLine("<Successes: ");
+	AppendNumber(successes);
+	AppendText(">");
+	results->AddMsg(resultline);
+	if (recording)
+		results->AddSuccesses(successes);
+}
+
+
+
+/* Botches are counted as negative successes. */
+void RollEngine::AddBotches(double successes)
+{
+	BeginLine("<BOTCHED ROLL! Botches: ");
+	AppendNumber(0-successes);
+	AppendText(">");
+	results->AddMsg(resultline);
+	if (recording)
+		results->AddBotches(0-successes);
+}
+
+
 
-	/* Add first line. */
-	results->AddMsg("<Results of Craps" + For() + ">" + message);
+void RollEngine::RollCraps()
+{
+	/* Add first line, with the rest of the parameters as an optional
+	 * message to be displayed with the roll. */
+	BeginLine("<Results of Craps");
+	AppendFor();
+	AppendText(">");
+	AppendMessage(1);
+	results->AddMsg(resultline);
 
 	/* Perform the first roll. */
 	double sum, point;
+	double won = 0;
 	unsigned int roll_count = 1;
 	sum = RollTheBones(2, 6);
 
@@ -112,36 +195,56 @@ void RollEngine::RollCraps()
 	else if (sum == 12) 
 		results->AddMsg("<Rolled a 12, box cars, you lose>");
 	else if (sum == 7) 
+	{
 		results->AddMsg("<Rolled a 7, a natural 7, you win>");
+		won = 1;
+	}
 	else if (sum == 11) 
+	{
 		results->AddMsg("<Rolled an 11, a natural 11, you win>");
+		won = 1;
+	}
 	else
 	{
 		/* The results of this first roll are now the point. */
 		point = sum;
-		results->AddMsg("<Rolled a " + Str(sum) + ", the point is " + Str(sum) + ">");
+		BeginLine("<Rolled a ");
+		AppendNumber(sum);
+		AppendText(", the point is ");
+		AppendNumber(sum);
+		AppendText(">");
+		results->AddMsg(resultline);
 
 		/* Keep rolling up to a limit until they win or lose. */
-		std::string point_str = Str(point);
 		while (roll_count < 10)
 		{
 			sum = RollTheBones(2, 6);
 			roll_count++;
 
+			BeginLine("<Rolled a ");
+			AppendNumber(sum);
+			AppendText(", the point was ");
+			AppendNumber(point);
 			if (sum == point)
 			{
-				results->AddMsg("<Rolled a " + Str(sum) + ", the point was " + point_str + ", matched point and won>");
+				AppendText(", matched point and won>");
+				results->AddMsg(resultline);
+				won = 1;
 				break;
 			}
 			else if (sum == 7)
 			{
-				results->AddMsg("<Rolled a 7, the point was " + point_str + ", sevened-out and lost>");
+				AppendText(", sevened-out and lost>");
+				results->AddMsg(resultline);
 				break;
 			}
-			else
-				results->AddMsg("<Rolled a " + Str(sum) + ", the point was " + point_str + ">");
+			AppendText(">");
+			results->AddMsg(resultline);
 		}
 	}
+
+	/* The outcome of a game is whether it was won. */
+	RecordOutcome(won);
 }
 
 
@@ -153,23 +256,22 @@ void RollEngine::RollD20()
 	{
 		results->Clear();
 		results->AddError("Error: D20 rolls require an additional parameter specifying the modifier to the roll, with an optional parameter for a target value.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 3; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the modifier. */
-	double mod = round(ReadExpression(roll->expression[1]));
+	double mod;
+	if (!ReadExpression(roll->expression[1], mod))
+		return;
+	mod = round(mod);
 
 	/* Get the target value, if one is provided. */
 	double diff = 0;
 	if (roll->expression.size() >= 3)
 	{
-		diff = round(ReadExpression(roll->expression[2]));
+		if (!ReadExpression(roll->expression[2], diff))
+			return;
+		diff = round(diff);
 	}
 
 	/* Perform the roll. */
@@ -180,25 +282,31 @@ void RollEngine::RollD20()
 	if (diff != 0 && result + mod >= diff)
 		success = true;
 
-	/* Output the results. */
+	/* Output the results, with the rest of the parameters as an optional
+	 * message to be displayed with the roll. */
+	BeginLine("<D20 check");
+	AppendFor();
+	AppendText(" [Modifier: ");
+	AppendNumber(mod, roll->expression[1]);
 	if (diff != 0)
 	{
-		std::string line = "<D20 check" + For() + " [Modifier: " + Str(mod, roll->expression[1]);
-		line += ", Diff: " + Str(diff, roll->expression[2]) + "]>" + message;
-		results->AddMsg(line);
-		line = "<Roll: " + Str(result);
-		line += ", Total: " + Str(result + mod) + " - ";
-		line += (success ? "Success" : "Failure");
-		line += ">";
-		results->AddMsg(line);
+		AppendText(", Diff: ");
+		AppendNumber(diff, roll->expression[2]);
 	}
+	AppendText("]>");
+	AppendMessage(3);
+	results->AddMsg(resultline);
+
+	BeginLine("<Roll: ");
+	AppendNumber(result);
+	AppendText(", Total: ");
+	AppendNumber(result + mod);
+	if (diff != 0)
+		AppendText(success ? " - Success>" : " - Failure>");
 	else
-	{
-		results->AddMsg("<D20 check" + For() + " [Modifier: " + Str(mod, roll->expression[1]) + "]>" + message);
-		std::string line = "<Roll: " + Str(result);
-		line += ", Total: " + Str(result + mod) + ">";
-		results->AddMsg(line);
-	}
+		AppendText(">");
+	results->AddMsg(resultline);
+	RecordOutcome(result + mod);
 }
 
 
@@ -210,54 +318,99 @@ void RollEngine::RollExalted(bool double_successes)
 	{
 		results->Clear();
 		results->AddError("Error: Exalted rolls require an additional parameter specifying the number of dice to roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 2; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: Exalted roll specified zero or negative dice to roll, and will have a single die instead.");
 
 		count = 1;
 	}
-	if (count > 40)
+	if (count > MAX_POOL_DICE)
 	{
-		results->AddError("Warning: Exalted roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
-
-		count = 40;
+		BeginLine("Warning: Exalted roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of ");
+		AppendInteger(MAX_POOL_DICE);
+		AppendText(" dice.");
+		results->AddError(resultline);
+
+		count = MAX_POOL_DICE;
 	}
 
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<Exalted roll" + For() + " [Dice: " + Str(count, roll->expression[1]) + "]>" + message);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll. */
+	BeginLine("<Exalted roll");
+	AppendFor();
+	AppendText(" [Dice: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText("]>");
+	AppendMessage(2);
+	results->AddMsg(resultline);
 
 	/* Perform the roll. */
 	double successes = 0;
-	for (unsigned int i = 0; i < count; i++)
+	if (count > MAX_POOL_SHOWN)
+	{
+		/* Pools too large to show die by die are rolled in summary,
+		 * drawing how many dice show each face. */
+		unsigned int faces[11];
+		RollFaceCounts(faces, count, 10);
+		AddFaceCounts(faces, 10);
+
+		successes = faces[7] + faces[8] + faces[9] + faces[10];
+		if (double_successes)
+			successes += faces[10];
+	}
+	else
 	{
-		double result = RollTheBones(1, 10);
-		resultline += Str(result);
+		BeginLine("<");
+		uint32_t dice[MAX_POOL_SHOWN];
+		RollDice(dice, count, 10);
+		RecordDice(dice, count, 10);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			double result = dice[i];
+			AppendNumber(result);
 
-		if (result >= 7)
-			successes++;
-		if (result == 10 && double_successes)
-			successes++;
+			if (result >= 7)
+				successes++;
+			if (result == 10 && double_successes)
+				successes++;
 
-		if (i != count -1)
-			resultline += " ";
+			if (i != count -1)
+				AppendText(" ");
+		}
+
+		AppendText(">");
+		results->AddMsg(resultline);
 	}
 
 	/* Finish the results. */
-	resultline += ">";
-	results->AddMsg(resultline);
-	results->AddMsg("<Successes: " + Str(successes) + ">");
+	AddSuccesses(successes);
+	RecordOutcome(successes);
+}
+
+
+
+/* Exalted's first edition counts 10s as double successes; its second
+ * edition doesn't. */
+void RollEngine::RollExalted1E()
+{
+	RollExalted(1);
+}
+
+
+
+void RollEngine::RollExalted2E()
+{
+	RollExalted(0);
 }
 
 
@@ -269,116 +422,163 @@ void RollEngine::RollNewHorizons()
 	{
 		results->Clear();
 		results->AddError("Error: New Horizons rolls require one additional parameters specifying the number of dice to roll, with an optional parameter for the difficulty of the roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 3; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: New Horizons roll specified zero or negative dice to roll, and will roll one die instead.");
 
 		count = 1;
 	}
-	if (count > 40)
+	if (count > MAX_POOL_DICE)
 	{
-		results->AddError("Warning: New Horizons roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
-
-		count = 40;
+		BeginLine("Warning: New Horizons roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of ");
+		AppendInteger(MAX_POOL_DICE);
+		AppendText(" dice.");
+		results->AddError(resultline);
+
+		count = MAX_POOL_DICE;
 	}
 
 	/* Get the difficulty of the roll. */
 	double diff = 7;
-	std::string diffstr = "7";
 	if (roll->expression.size() >= 3)
 	{
-		diff = round(ReadExpression(roll->expression[2]));
-		diffstr = Str(diff, roll->expression[2]);
+		if (!ReadExpression(roll->expression[2], diff))
+			return;
+		diff = round(diff);
 	}
 
 
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<New Horizons roll" + For() + " [Dice: " + Str(count, roll->expression[1]) + ", Diff: " + diffstr + "]>" + message);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll. */
+	BeginLine("<New Horizons roll");
+	AppendFor();
+	AppendText(" [Dice: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText(", Diff: ");
+	if (roll->expression.size() >= 3)
+		AppendNumber(diff, roll->expression[2]);
+	else
+		AppendNumber(diff);
+	AppendText("]>");
+	AppendMessage(3);
+	results->AddMsg(resultline);
 
 	/* Perform the roll. */
 	double successes = 0;
-	for (unsigned int i = 0; i < count; i++)
+	if (count > MAX_POOL_SHOWN)
 	{
-		double die = RollTheBones(1, 10);
-		double result = die;
-
-		while (die == 10)
+		/* Pools too large to show die by die are rolled in summary,
+		 * drawing how many dice show each face. */
+		unsigned int faces[11];
+		RollFaceCounts(faces, count, 10);
+		AddFaceCounts(faces, 10);
+
+		successes -= faces[1];
+		for (unsigned int face = 2; face < 10; face++)
+			if (face >= diff)
+				successes += faces[face];
+
+		/* Tens explode; of the dice still exploding, a tenth explode
+		 * again, and the rest stop on a face from 1 to 9 added to the
+		 * tens so far. Only enough of those faces meet the difficulty to
+		 * succeed. */
+		unsigned int exploding = faces[10];
+		for (double tens = 10; exploding; tens += 10)
 		{
-			die = RollTheBones(1, 10);
-			result += die;
+			unsigned int again = Binomial(exploding, 0.1);
+			unsigned int stopped = exploding - again;
+			double meeting = std::min(std::max(tens + 10 - diff, 0.0), 9.0);
+			successes += Binomial(stopped, meeting / 9);
+			exploding = again;
 		}
+	}
+	else
+	{
+		BeginLine("<");
+		uint32_t dice[MAX_POOL_SHOWN];
+		RollDice(dice, count, 10);
+		RecordDice(dice, count, 10);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			double result = dice[i];
+			if (result == 10)
+			{
+				unsigned int last;
+				result += 10 * RollExplosions(10, UINT_MAX, last) + last;
+			}
 
-		if (result == 1)
-			successes--;
-		else if (result >= diff)
-			successes++;
+			if (result == 1)
+				successes--;
+			else if (result >= diff)
+				successes++;
 
 
-		resultline += Str(result);
-		if (i != count - 1)
-			resultline += " ";
+			AppendNumber(result);
+			if (i != count - 1)
+				AppendText(" ");
+		}
+
+		AppendText(">");
+		results->AddMsg(resultline);
 	}
 
 	/* Finish the results. */
-	resultline += ">";
-	results->AddMsg(resultline);
 	if (successes > 0 )
-		results->AddMsg("<Successes: " + Str(successes) + ">");
+		AddSuccesses(successes);
 	else if (successes < 0 )
-		results->AddMsg("<BOTCHED ROLL! Botches: " + Str(0-successes) + ">");
+		AddBotches(successes);
 	else
 		results->AddMsg("<Simple Failure>");
-
+	RecordOutcome(successes, successes < 0);
 }
 
 
 
 void RollEngine::RollRTD()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++) {
-		if (i==1)
-			message += ":";
-		message += " " + roll->expression[i];
-	}
-
-
 	/* The Evil Switch Knoweth All things. */
 
-	switch ((int)RollTheBones(1,6)) {
+	int die = (int)RollTheBones(1,6);
+	BeginLine("<RTD roll");
+	AppendFor();
+	switch (die) {
 		case 1:
-			results->AddMsg("<RTD roll" + For() + ": 1 - Horrifyingly Bad" + message + ">");
+			AppendText(": 1 - Horrifyingly Bad");
 			break;
 		case 2:
-			results->AddMsg("<RTD roll" + For() + ": 2 - Failure" + message + ">");
+			AppendText(": 2 - Failure");
 			break;
 		case 3:
-			results->AddMsg("<RTD roll" + For() + ": 3 - Partial Success" + message + ">");
+			AppendText(": 3 - Partial Success");
 			break;
 		case 4:
-			results->AddMsg("<RTD roll" + For() + ": 4 - Success" + message + ">");
+			AppendText(": 4 - Success");
 			break;
 		case 5:
-			results->AddMsg("<RTD roll" + For() + ": 5 - Perfect Success" + message + ">");
+			AppendText(": 5 - Perfect Success");
 			break;
 		default:
-			results->AddMsg("<RTD roll" + For() + ": 6 - Horrifyingly Good" + message + ">");
+			AppendText(": 6 - Horrifyingly Good");
 	}
 
+	/* The rest of the parameters are an optional message to be displayed
+	 * with the roll, after a colon. */
+	if (roll->expression.size() > 1)
+		AppendText(":");
+	AppendMessage(1);
+	AppendText(">");
+	results->AddMsg(resultline);
+	RecordOutcome(die);
 }
 
 
@@ -390,17 +590,14 @@ void RollEngine::RollShadowrun()
 	{
 		results->Clear();
 		results->AddError("Error: Shadowrun rolls require two additional parameters specifying the number of dice to roll, and the difficulty of the roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 3; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: Shadowrun roll specified zero or negative dice to roll, and will roll one die instead.");
@@ -409,52 +606,69 @@ void RollEngine::RollShadowrun()
 	}
 	if (count > 40)
 	{
-		results->AddError("Warning: Shadowrun roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
+		BeginLine("Warning: Shadowrun roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
+		results->AddError(resultline);
 
 		count = 40;
 	}
 
 	/* Get the difficulty of the roll. */
-	double diff = round(ReadExpression(roll->expression[2]));
-
-
-	/* Add the descriptive line and start the result line. */
-	std::string descline = "<Shadowrun roll" + For() + " [Dice: " + Str(count, roll->expression[1]);
-	descline += ", Diff: " + Str(diff, roll->expression[2]) + "]>" + message;
-	results->AddMsg(descline);
-	std::string resultline = "<";
+	double diff;
+	if (!ReadExpression(roll->expression[2], diff))
+		return;
+	diff = round(diff);
+
+
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll, and start the result
+	 * line. */
+	BeginLine("<Shadowrun roll");
+	AppendFor();
+	AppendText(" [Dice: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText(", Diff: ");
+	AppendNumber(diff, roll->expression[2]);
+	AppendText("]>");
+	AppendMessage(3);
+	results->AddMsg(resultline);
+	BeginLine("<");
 
 	/* Perform the roll. */
+	uint32_t dice[40];
+	RollDice(dice, count, 6);
 	double successes = 0;
 	for (unsigned int i = 0; i < count; i++)
 	{
-		double die = RollTheBones(1, 6);
-		double result = die;
+		double result = dice[i];
 
-		while (die == 6)
+		/* Sixes explode, up to a total of 120. The die is recorded with
+		 * its total. */
+		if (result == 6)
 		{
-			if (result >= 120)
-			{
-				if (IncWarningCount())
-					results->AddError("Warning: Shadowrun roll result exceeded maximum number of repeats, was capped at 120.");
-				break;
-			}
-			die = RollTheBones(1, 6);
-			result += die;
+			unsigned int last;
+			unsigned int explosions = RollExplosions(6, 19, last);
+			result += 6 * explosions + last;
+			dice[i] = (uint32_t)result;
+			if (!last && IncWarningCount())
+				results->AddError("Warning: Shadowrun roll result exceeded maximum number of repeats, was capped at 120.");
 		}
 
 		if (result >= diff)
 			successes++;
 
-		resultline += Str(result);
+		AppendNumber(result);
 		if (i != count - 1)
-			resultline += " ";
+			AppendText(" ");
 	}
 
 	/* Finish the results. */
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
-	results->AddMsg("<Successes: " + Str(successes) + ">");
+	RecordDice(dice, count, 6);
+	AddSuccesses(successes);
+	RecordOutcome(successes);
 }
 
 
@@ -466,79 +680,118 @@ void RollEngine::RollWOD()
 	{
 		results->Clear();
 		results->AddError("Error: World of Darkness rolls require an additional parameters specifying the number of dice to roll, with an optional parameter for the difficulty of the roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 3; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: World of Darkness roll specified zero or negative dice to roll, and will roll one die instead.");
 
 		count = 1;
 	}
-	if (count > 40)
+	if (count > MAX_POOL_DICE)
 	{
-		results->AddError("Warning: World of Darkness roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
-
-		count = 40;
+		BeginLine("Warning: World of Darkness roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of ");
+		AppendInteger(MAX_POOL_DICE);
+		AppendText(" dice.");
+		results->AddError(resultline);
+
+		count = MAX_POOL_DICE;
 	}
 
 	/* Get the difficulty of the roll. */
 	double diff = 6;
-	std::string diffstr = "6";
 	if (roll->expression.size() >= 3)
 	{
-		diff = round(ReadExpression(roll->expression[2]));
-		diffstr = Str(diff, roll->expression[2]);
+		if (!ReadExpression(roll->expression[2], diff))
+			return;
+		diff = round(diff);
 	}
 
 	
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<World of Darkness roll" + For() + " [Dice: " + Str(count, roll->expression[1]) + ", Diff: " + diffstr + "]>" + message);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll. */
+	BeginLine("<World of Darkness roll");
+	AppendFor();
+	AppendText(" [Dice: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText(", Diff: ");
+	if (roll->expression.size() >= 3)
+		AppendNumber(diff, roll->expression[2]);
+	else
+		AppendNumber(diff);
+	AppendText("]>");
+	AppendMessage(3);
+	results->AddMsg(resultline);
 
 	/* Perform the roll. */
 	double successes = 0;
 	double rerolls = 0;
-	for (unsigned int i = 0; i < count; i++)
+	if (count > MAX_POOL_SHOWN)
 	{
-		double die = RollTheBones(1, 10);
-
-		if (die == 10)
+		/* Pools too large to show die by die are rolled in summary,
+		 * drawing how many dice show each face. */
+		unsigned int faces[11];
+		RollFaceCounts(faces, count, 10);
+		AddFaceCounts(faces, 10);
+
+		rerolls = faces[10];
+		successes -= faces[1];
+		for (unsigned int face = 1; face <= 10; face++)
+			if (face >= diff)
+				successes += faces[face];
+	}
+	else
+	{
+		BeginLine("<");
+		uint32_t dice[MAX_POOL_SHOWN];
+		RollDice(dice, count, 10);
+		RecordDice(dice, count, 10);
+		for (unsigned int i = 0; i < count; i++)
 		{
-			++rerolls;
-		} else if (die == 1) {
-			--successes;
-		}
+			double die = dice[i];
 
-		if (die >= diff)
-			successes++;
+			if (die == 10)
+			{
+				++rerolls;
+			} else if (die == 1) {
+				--successes;
+			}
 
-		resultline += Str(die);
-		if (i != count - 1)
-			resultline += " ";
+			if (die >= diff)
+				successes++;
+
+			AppendNumber(die);
+			if (i != count - 1)
+				AppendText(" ");
+		}
+
+		AppendText(">");
+		results->AddMsg(resultline);
 	}
 
 	/* Finish the results. */
-	resultline += ">";
-	results->AddMsg(resultline);
 	if (successes > 0 && rerolls > 0) {
-		std::string totalline = "<Successes: " + Str(successes) + ", ";
-		totalline += "Rerolls: " + Str(rerolls) + " (with a specialization)>";
-		results->AddMsg(totalline);
+		BeginLine("<Successes: ");
+		AppendNumber(successes);
+		AppendText(", Rerolls: ");
+		AppendNumber(rerolls);
+		AppendText(" (with a specialization)>");
+		results->AddMsg(resultline);
 	} else if (successes > 0 )
-		results->AddMsg("<Successes: " + Str(successes) + ">");
+		AddSuccesses(successes);
 	else if (successes < 0 )
-		results->AddMsg("<BOTCHED ROLL! Botches: " + Str(0-successes) + ">");
+		AddBotches(successes);
 	else
 		results->AddMsg("<Simple Failure>");
+	RecordOutcome(successes, successes < 0);
 }
 
 
@@ -550,17 +803,14 @@ void RollEngine::RollRWOD()
 	{
 		results->Clear();
 		results->AddError("Error: Revised Edition World of Darkness rolls require an additional parameter specifying the number of dice to roll, with an optional parameter for the difficulty of the roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 3; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: Revised Edition World of Darkness roll specified zero or negative dice to roll, and will roll one die instead.");
@@ -569,32 +819,51 @@ void RollEngine::RollRWOD()
 	}
 	if (count > 40)
 	{
-		results->AddError("Warning: Revised Edition World of Darkness roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
+		BeginLine("Warning: Revised Edition World of Darkness roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
+		results->AddError(resultline);
 
 		count = 40;
 	}
 
 	/* Get the difficulty of the roll. */
 	double diff = 6;
-	std::string diffstr = "6";
 	if (roll->expression.size() >= 3)
 	{
-		diff = round(ReadExpression(roll->expression[2]));
-		diffstr = Str(diff, roll->expression[2]);
+		if (!ReadExpression(roll->expression[2], diff))
+			return;
+		diff = round(diff);
 	}
 
 
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<Revised Edition World of Darkness roll" + For() + " [Dice: " + Str(count, roll->expression[1]) + ", Diff: " + diffstr + "]>" + message);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll, and start the result
+	 * line. */
+	BeginLine("<Revised Edition World of Darkness roll");
+	AppendFor();
+	AppendText(" [Dice: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText(", Diff: ");
+	if (roll->expression.size() >= 3)
+		AppendNumber(diff, roll->expression[2]);
+	else
+		AppendNumber(diff);
+	AppendText("]>");
+	AppendMessage(3);
+	results->AddMsg(resultline);
+	BeginLine("<");
 
 	/* Perform the roll. */
+	uint32_t dice[40];
+	RollDice(dice, count, 10);
+	RecordDice(dice, count, 10);
 	double successes = 0;
 	double ones = 0;
 	for (unsigned int i = 0; i < count; i++)
 	{
-		double die = RollTheBones(1, 10);
-		resultline += Str(die);
+		double die = dice[i];
+		AppendNumber(die);
 
 		if (die >= diff)
 			successes++;
@@ -602,29 +871,25 @@ void RollEngine::RollRWOD()
 			ones++;
 
 		if (die == 10) {
-			resultline += "(";
-			while (die == 10) {
-				die=RollTheBones(1, 10);
-				resultline += Str(die);
-				if (die == 10)
-					resultline += ",";
-			}
-			resultline += ")";
+			unsigned int last;
+			unsigned int explosions = RollExplosions(10, UINT_MAX, last);
+			AppendExplosionChain(10, explosions, last);
 		}
 
 		if (i != count - 1)
-			resultline += " ";
+			AppendText(" ");
 	}
 
 	/* Finish the results. */
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 	if (successes > 0 )
-		results->AddMsg("<Successes: " + Str(successes) + ">");
+		AddSuccesses(successes);
 	else if (successes == 0 && ones > 0)
 		results->AddMsg("<BOTCHED ROLL!");
 	else
 		results->AddMsg("<Simple Failure>");
+	RecordOutcome(successes, successes == 0 && ones > 0);
 }
 
 
@@ -636,81 +901,100 @@ void RollEngine::RollNWOD()
 	{
 		results->Clear();
 		results->AddError("Error: New World of Darkness rolls require you specify the number of dice in your dice pool to roll.");
-		throw new RollException;
+		return;
 	}
 
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 2; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
 	/* Get the number of rolls to make. */
-	double count = round(ReadExpression(roll->expression[1]));
+	double count;
+	if (!ReadExpression(roll->expression[1], count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: New World of Darkness roll specified zero or negative dice to roll, and will roll one die instead.");
 
 		count = 1;
 	}
-	if (count > 40)
+	if (count > MAX_POOL_DICE)
 	{
-		results->AddError("Warning: New World of Darkness roll specified " + Str(count) + " dice to roll, exceeding the maximum, and was capped at the maximum of 40 dice.");
-
-		count = 40;
+		BeginLine("Warning: New World of Darkness roll specified ");
+		AppendNumber(count);
+		AppendText(" dice to roll, exceeding the maximum, and was capped at the maximum of ");
+		AppendInteger(MAX_POOL_DICE);
+		AppendText(" dice.");
+		results->AddError(resultline);
+
+		count = MAX_POOL_DICE;
 	}
 
-	/* Add the descriptive line and start the result line. */
-	std::string descline = "<New World of Darkness roll" + For() + " [Dice Pool: " + Str(count, roll->expression[1]);
-	descline += "]>" + message;
-	results->AddMsg(descline);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll. */
+	BeginLine("<New World of Darkness roll");
+	AppendFor();
+	AppendText(" [Dice Pool: ");
+	AppendNumber(count, roll->expression[1]);
+	AppendText("]>");
+	AppendMessage(2);
+	results->AddMsg(resultline);
 
 	/* Perform the roll. */
 	double successes = 0;
-	for (unsigned int i = 0; i < count; i++)
+	if (count > MAX_POOL_SHOWN)
 	{
-		double die = RollTheBones(1, 10);
-
-		if (die >= 6)
-			successes++;
-		resultline += Str(die);
-		if (die == 10) {
-			resultline += "(";
-			while (die == 10) {
-				die=RollTheBones(1, 10);
-				resultline += Str(die);
-				if (die == 10)
-					resultline += ",";
+		/* Pools too large to show die by die are rolled in summary,
+		 * drawing how many dice show each face. Rerolled tens only
+		 * ever added to the display, so there is nothing to reroll. */
+		unsigned int faces[11];
+		RollFaceCounts(faces, count, 10);
+		AddFaceCounts(faces, 10);
+
+		successes = faces[6] + faces[7] + faces[8] + faces[9] + faces[10];
+	}
+	else
+	{
+		BeginLine("<");
+		uint32_t dice[MAX_POOL_SHOWN];
+		RollDice(dice, count, 10);
+		RecordDice(dice, count, 10);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			double die = dice[i];
+
+			if (die >= 6)
+				successes++;
+			AppendNumber(die);
+			if (die == 10) {
+				unsigned int last;
+				unsigned int explosions = RollExplosions(10, UINT_MAX, last);
+				AppendExplosionChain(10, explosions, last);
 			}
-			resultline += ")";
+			if (i != count - 1)
+				AppendText(" ");
 		}
-		if (i != count - 1)
-			resultline += " ";
+
+		AppendText(">");
+		results->AddMsg(resultline);
 	}
 
 	/* Finish the results. */
-	resultline += ">";
-	results->AddMsg(resultline);
 	if (successes > 0 )
-		results->AddMsg("<Successes: " + Str(successes) + ">");
+		AddSuccesses(successes);
 	else
 		results->AddMsg("<Failure>");
-
+	RecordOutcome(successes);
 }
 
 
 
 void RollEngine::RollNWODChance()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<New World of Darkness chance die roll" + For() + ">" + message);
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll. */
+	BeginLine("<New World of Darkness chance die roll");
+	AppendFor();
+	AppendText(">");
+	AppendMessage(1);
+	results->AddMsg(resultline);
 
 	/* Perform the roll. */
 	double die = RollTheBones(1, 10);
@@ -719,43 +1003,52 @@ void RollEngine::RollNWODChance()
 	else if (die == 1)
 		results->AddMsg("<DRAMATIC FAILURE!>");
 	else
-		results->AddMsg("<Failure: " + Str(die) + ">");
-
+	{
+		BeginLine("<Failure: ");
+		AppendNumber(die);
+		AppendText(">");
+		results->AddMsg(resultline);
+	}
+	RecordOutcome(die == 10, die == 1);
 }
 
 
 
 void RollEngine::RollDND2EInit()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
-
-	/* Add the descriptive line and start the result line. */
-	std::string initrslt = "<D&D Initiative roll" + For();
-	initrslt += ": " + Str(RollTheBones(1,10)) + "> " + message;
-	results->AddMsg(initrslt);
+	/* Add the result line, with the rest of the parameters as an optional
+	 * message to be displayed with the roll. */
+	double initiative = RollTheBones(1,10);
+	BeginLine("<D&D Initiative roll");
+	AppendFor();
+	AppendText(": ");
+	AppendNumber(initiative);
+	AppendText("> ");
+	AppendMessage(1);
+	results->AddMsg(resultline);
+	RecordOutcome(initiative);
 }
 
 
 
 void RollEngine::RollDNDAlias()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
-	/* The label to use is the expression in lowercase. */
-	std::string label = roll->expression[0];
-	std::transform(label.begin(), label.end(), label.begin(), tolower);
-
-	/* Add result. */
-	results->AddMsg("<D&D " + label + " roll" + For() + ": " + Str(RollTheBones(1, 20)) + ">" + message);
+	/* Add result, with the rest of the parameters as an optional message
+	 * to be displayed with the roll. The label to use is the expression in
+	 * lowercase. */
+	double result = RollTheBones(1, 20);
+	BeginLine("<D&D ");
+	size_t label = resultline.size();
+	AppendText(roll->expression[0]);
+	std::transform(resultline.begin() + label, resultline.end(), resultline.begin() + label, tolower);
+	AppendText(" roll");
+	AppendFor();
+	AppendText(": ");
+	AppendNumber(result);
+	AppendText(">");
+	AppendMessage(1);
+	results->AddMsg(resultline);
+	RecordOutcome(result);
 }
 
 
@@ -765,7 +1058,9 @@ void RollEngine::RollEEBarrel()
 	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM || roll->outputtype == IRC_SELF)
 	{
 		results->AddAction("roars and beats its chest");
-		results->AddAction("throws a barrel at " + roll->extra[0]);
+		BeginLine("throws a barrel at ");
+		AppendText(roll->extra[0]);
+		results->AddAction(resultline);
 		if (roll->outputtype == IRC_CHAN)
 			results->AddNPC("BotServ", "Do a barrel roll!");
 
@@ -775,13 +1070,17 @@ void RollEngine::RollEEBarrel()
 		// Did they save?
 		if (save > 5)
 		{
-			results->AddAction("roars angrily as the barrel bounces past " + roll->extra[0]);
+			BeginLine("roars angrily as the barrel bounces past ");
+			AppendText(roll->extra[0]);
+			results->AddAction(resultline);
 			if (roll->outputtype == IRC_CHAN)
 				results->AddNPC("BotServ", "You did it! I was worried for a moment.");
 		}
 		else
 		{
-			results->AddAction("roars in triumph as the barrel hits " + roll->extra[0]);
+			BeginLine("roars in triumph as the barrel hits ");
+			AppendText(roll->extra[0]);
+			results->AddAction(resultline);
 			results->AddError("Game over.");
 		}
 	}
@@ -813,7 +1112,9 @@ void RollEngine::RollEEInTheHay()
 {
 	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM || roll->outputtype == IRC_SELF)
 	{
-		results->AddAction("beats the \2hell\2 out of " + roll->extra[0]);
+		BeginLine("beats the \2hell\2 out of ");
+		AppendText(roll->extra[0]);
+		results->AddAction(resultline);
 		results->AddMsg("I'm \2NOT\2 that kind of \2SERVICE\2 SICKO!");
 		results->AddError("Try OperServ or something; he might be into that.");
 	}
@@ -833,7 +1134,9 @@ void RollEngine::RollEEJoint()
 		fuzzfactor--;
 
 		/* Give them one. */
-		results->AddAction("passes a 'cigarette' to " + roll->extra[0]);
+		BeginLine("passes a 'cigarette' to ");
+		AppendText(roll->extra[0]);
+		results->AddAction(resultline);
 
 		/* Check Fuzz Factor to find out if they get busted. */
 		if (fuzzfactor > 0)
@@ -848,11 +1151,19 @@ void RollEngine::RollEEJoint()
 			if (roll->outputtype == IRC_CHAN)
 			{
 				results->AddNPCA("OperServ", "busts into the room with guns blazing");
-				results->AddNPC("OperServ", "\002FREEZE!\002 " + roll->extra[0] + ", this is a raid!");
-
-				std::string sentencing = "sentences " + roll->extra[0] + " to " + Str(floor(shuntime/60));
-				sentencing += " minutes, " + Str(shuntime - floor(shuntime/60)*60) + " seconds in prison";
-				results->AddNPCA("OperServ", sentencing);
+				BeginLine("\002FREEZE!\002 ");
+				AppendText(roll->extra[0]);
+				AppendText(", this is a raid!");
+				results->AddNPC("OperServ", resultline);
+
+				BeginLine("sentences ");
+				AppendText(roll->extra[0]);
+				AppendText(" to ");
+				AppendNumber(floor(shuntime/60));
+				AppendText(" minutes, ");
+				AppendNumber(shuntime - floor(shuntime/60)*60);
+				AppendText(" seconds in prison");
+				results->AddNPCA("OperServ", resultline);
 			}
 			results->AddShun("Say no to drugs!", shuntime);
 
@@ -877,11 +1188,13 @@ void RollEngine::RollEEJointFuzzFactor()
 		{
 			results->Clear();
 			results->AddError("Error: Fuzz Factor setting requires an additional parameter giving what to set the Fuzz Factor to.");
-			throw new RollException;
+			return;
 		}
 
 		/* Get the value to set Fuzz Factor to. */
-		fuzzfactor = round(ReadExpression(roll->expression[1]));
+		if (!ReadExpression(roll->expression[1], fuzzfactor))
+			return;
+		fuzzfactor = round(fuzzfactor);
 		if (fuzzfactor < 1)
 		{
 			results->AddError("Warning: Fuzz Factor specified zero or negative value, and was set to 1 instead.");
@@ -890,7 +1203,12 @@ void RollEngine::RollEEJointFuzzFactor()
 		}
 
 		/* Tell them it was done. */
-		results->AddMsg("<Fuzz Factor set" + For() + " to " + Str(fuzzfactor, roll->expression[1]) + ">");
+		BeginLine("<Fuzz Factor set");
+		AppendFor();
+		AppendText(" to ");
+		AppendNumber(fuzzfactor, roll->expression[1]);
+		AppendText(">");
+		results->AddMsg(resultline);
 	}
 	else
 	{
@@ -904,7 +1222,10 @@ void RollEngine::RollEEOver()
 {
 	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM || roll->outputtype == IRC_SELF)
 	{
-		results->AddAction("kicks " + roll->extra[0] + " in the shin.");
+		BeginLine("kicks ");
+		AppendText(roll->extra[0]);
+		AppendText(" in the shin.");
+		results->AddAction(resultline);
 		results->AddMsg("What am I, your dog?");
 		results->AddError("I am not a dog, moron!");
 	}
@@ -924,7 +1245,10 @@ void RollEngine::RollEERick()
 		results->AddMsg("Never gonna give you up, never gonna let you down...");
 		results->AddMsg("Never gonna run around, and desert you! Never gonna make you cry...");
 		results->AddMsg("Never gonna say goodbye! Never gonna tell a lie, and hurt you!");
-		results->AddMsg("You just got roll ricked. *dances out, leaving " + roll->extra[0] + " a bill*");
+		BeginLine("You just got roll ricked. *dances out, leaving ");
+		AppendText(roll->extra[0]);
+		AppendText(" a bill*");
+		results->AddMsg(resultline);
 		results->AddError("That'll be $750.");
 	}
 	else
@@ -939,7 +1263,10 @@ void RollEngine::RollEEYourMom()
 {
 	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM || roll->outputtype == IRC_SELF)
 	{
-		results->AddMsg("No thanks " + roll->extra[0] + ". Oh, by the way, here's the $20 I owe YOUR mom for last night.");
+		BeginLine("No thanks ");
+		AppendText(roll->extra[0]);
+		AppendText(". Oh, by the way, here's the $20 I owe YOUR mom for last night.");
+		results->AddMsg(resultline);
 		results->AddError("Yo Momma!");
 	}
 	else
@@ -954,8 +1281,14 @@ void RollEngine::RollEEYourDad()
 {
 	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM || roll->outputtype == IRC_SELF)
 	{
-		results->AddMsg("No thanks " + roll->extra[0] + ". Your dad would be jealous.");
-		results->AddScene("This explains those slurping noises coming from " + roll->extra[0] + "'s father's room last night!");
+		BeginLine("No thanks ");
+		AppendText(roll->extra[0]);
+		AppendText(". Your dad would be jealous.");
+		results->AddMsg(resultline);
+		BeginLine("This explains those slurping noises coming from ");
+		AppendText(roll->extra[0]);
+		AppendText("'s father's room last night!");
+		results->AddScene(resultline);
 		results->AddError("Schwing!");
 	}
 	else
@@ -970,11 +1303,7 @@ void RollEngine::RollEEYourDad()
  * called. */
 void RollEngine::RollRepeatedExpression()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
+	results->preset = PRESET_REPEATED_EXPRESSION;
 
 	/* Split the count expression and sub expression out. */
 	const char* fullexpression = roll->expression[0].c_str();
@@ -983,7 +1312,10 @@ void RollEngine::RollRepeatedExpression()
 	std::string subexpression = roll->expression[0].substr(position + 1, strlen(fullexpression) - position - 2);
 
 	/* Get the count. */
-	double count = round(ReadExpression(countexpression));
+	double count;
+	if (!ReadExpression(countexpression, count))
+		return;
+	count = round(count);
 	if (count < 1)
 	{
 		results->AddError("Warning: Repeated roll specified zero or negative repeats, and will be performed once instead.");
@@ -992,14 +1324,27 @@ void RollEngine::RollRepeatedExpression()
 	}
 	if (count > 40)
 	{
-		results->AddError("Warning: Repeated roll specified " + Str(count) + " repeats, exceeding the maximum, and was capped at the maximum of 40 repeats.");
+		BeginLine("Warning: Repeated roll specified ");
+		AppendNumber(count);
+		AppendText(" repeats, exceeding the maximum, and was capped at the maximum of 40 repeats.");
+		results->AddError(resultline);
 
 		count = 40;
 	}
 
-	/* Add the descriptive line and start the result line. */
-	results->AddMsg("<Repeated roll" + For() + " [Expression: " + subexpression + ", Repeats: " + Str(count, countexpression) + "]>" + message);
-	std::string resultline = "<";
+	/* Add the descriptive line, with the rest of the parameters as an
+	 * optional message to be displayed with the roll, and start the result
+	 * line. */
+	BeginLine("<Repeated roll");
+	AppendFor();
+	AppendText(" [Expression: ");
+	AppendText(subexpression);
+	AppendText(", Repeats: ");
+	AppendNumber(count, countexpression);
+	AppendText("]>");
+	AppendMessage(1);
+	results->AddMsg(resultline);
+	BeginLine("<");
 
 	/* Handle special RPG expressions the parser cannot handle. */
 	/* These must not be system-specific presets, must not produce more
@@ -1009,9 +1354,12 @@ void RollEngine::RollRepeatedExpression()
 		/* "%" means 1d100. */
 		for (size_t i = 0; i < count; i++)
 		{
-			resultline += Str(RollTheBones(1, 100));
+			double result = RollTheBones(1, 100);
+			AppendNumber(result);
+			if (recording)
+				results->AddExpression(subexpression, result);
 			if (i + 1 != count)
-				resultline += " ";
+				AppendText(" ");
 		}
 	}
 	else if (!strcasecmp(subexpression.c_str(), "d%HL") || !strcasecmp(subexpression.c_str(), "%HL"))
@@ -1033,9 +1381,11 @@ void RollEngine::RollRepeatedExpression()
 			else
 				result = tens * 10 + ones;
 
-			resultline += Str(result);
+			AppendNumber(result);
+			if (recording)
+				results->AddExpression(subexpression, result);
 			if (i + 1 != count)
-				resultline += " ";
+				AppendText(" ");
 		}
 	}
 
@@ -1043,17 +1393,37 @@ void RollEngine::RollRepeatedExpression()
 	 * number of times, adding the results to the result line. */
 	else
 	{
-		expression->Parse(subexpression.c_str());
+		double values[40];
+		if (!expression->Parse(subexpression.c_str()))
+			return;
+		expression_cost += expression->Cost * count;
+
+		/* The batched dice are handed out to the rolls together, so
+		 * when recording roll data, each roll's dice are held until the
+		 * batch is done, to record them just before it, as for a single
+		 * expression. No more rolls are repeated than fit in one batch. */
+		holding = recording;
+		expression->EvalBatch((size_t)count, values);
+		holding = false;
+
 		for (size_t i = 0; i < count; i++)
 		{
-			resultline += Str(expression->Eval());
+			if (recording)
+			{
+				RecordHeldDice(i);
+				results->AddExpression(subexpression, values[i]);
+			}
+			if (expression->Integral)
+				AppendInteger((int64_t)values[i]);
+			else
+				AppendNumber(values[i]);
 			if (i + 1 != count)
-				resultline += " ";
+				AppendText(" ");
 		}
 	}
 
 	/* Add the end of the result line, and add it. */
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -1061,15 +1431,28 @@ void RollEngine::RollRepeatedExpression()
 
 void RollEngine::RollExpression()
 {
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 1; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
+	results->preset = PRESET_EXPRESSION;
 
 	/* Do the roll... */
-	double result = ReadExpression(roll->expression[0]);
-
-	/* Add result. */
-	results->AddMsg("<Results" + For() + " [" + roll->expression[0] + "]: " + Str(result) + ">" + message);
+	double result;
+	if (!ReadExpression(roll->expression[0], result))
+		return;
+
+	/* Add result, with the rest of the parameters as an optional message
+	 * to be displayed with the roll. Whole number results are written out
+	 * as integers. */
+	BeginLine("<Results");
+	AppendFor();
+	AppendText(" [");
+	AppendText(roll->expression[0]);
+	AppendText("]: ");
+	if (expression_parsed && expression->Integral)
+		AppendInteger((int64_t)result);
+	else
+		AppendNumber(result);
+	AppendText(">");
+	AppendMessage(1);
+	results->AddMsg(resultline);
+	RecordOutcome(result);
+	outcome_expression = expression_parsed;
 }
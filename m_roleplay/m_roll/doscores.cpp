@@ -5,6 +5,8 @@
 
 void RollEngine::DoScores()
 {
+	results->preset = PRESET_SCORES;
+
 	if (!strcasecmp(roll->expression[0].c_str(), "D&D") || !strcasecmp(roll->expression[0].c_str(), "DND"))
 	{
 		ScoresDND();
@@ -17,7 +19,7 @@ void RollEngine::DoScores()
 	{
 		results->Clear();
 		results->AddError("Unknown system for SCORES: " + roll->expression[0]);
-		throw new RollException;
+		return;
 	}
 }
 
@@ -29,21 +31,25 @@ void RollEngine::ScoresDND()
 	{
 		results->Clear();
 		results->AddError("A method between 1 and 7 must be specified when generating D&D Ability Scores.");
-		throw new RollException;
+		return;
 	}
 
 	/* Extract the method to be used to generate the character scores,
 	 * including generating the way this is to be displayed to the user. */
-	double method = round(ReadExpression(roll->expression[1]));
-
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 2; i < roll->expression.size(); i++)
-		message += " " + roll->expression[i];
-
-	/* Add the title line above the results of the roll. */
-	results->AddMsg("<D&D Ability Scores" + For() + " [Method: " + Str(method, roll->expression[1]) + "]>" + message);
+	double method;
+	if (!ReadExpression(roll->expression[1], method))
+		return;
+	method = round(method);
+
+	/* Add the title line above the results of the roll, with the rest of
+	 * the parameters as an optional message to be displayed with it. */
+	BeginLine("<D&D Ability Scores");
+	AppendFor();
+	AppendText(" [Method: ");
+	AppendNumber(method, roll->expression[1]);
+	AppendText("]>");
+	AppendMessage(2);
+	results->AddMsg(resultline);
 
 	if (method == 1)
 		ScoresDND1();
@@ -69,8 +75,10 @@ void RollEngine::ScoresDND()
 	else
 	{
 		results->Clear();
-		results->AddError("Unrecognised method for D&D SCORES: " + Str(method, roll->expression[1]));
-		throw new RollException;
+		BeginLine("Unrecognised method for D&D SCORES: ");
+		AppendNumber(method, roll->expression[1]);
+		results->AddError(resultline);
+		return;
 	}
 }
 
@@ -78,36 +86,40 @@ void RollEngine::ScoresDND()
 
 void RollEngine::ScoresDND1()
 {
-	std::string resultline = "<";
+	BeginLine("<");
 
 	/* Handle strength. */
 	double result = RollTheBones(3, 6);
-	resultline += "Str: " + Str(result);
+	AppendText("Str: ");
+	AppendNumber(result);
 	if (result == 18)
 	{
-		resultline += "/";
+		AppendText("/");
 		result = RollTheBones(1, 100);
 		if (result == 100)
 		{
-			resultline += "00";
+			AppendText("00");
 		}
 		else
 		{
-			convstream << std::setfill('0') << std::setw(2);
-			resultline += Str(result);
-			convstream << std::setw(0);
+			AppendPadded(result, 2);
 		}
 	}
-	resultline += " ";
+	AppendText(" ");
 
 	/* Handle the rest. */
-	resultline += "Dex: " + Str(RollTheBones(3, 6)) + " ";
-	resultline += "Con: " + Str(RollTheBones(3, 6)) + " ";
-	resultline += "Int: " + Str(RollTheBones(3, 6)) + " ";
-	resultline += "Wis: " + Str(RollTheBones(3, 6)) + " ";
-	resultline += "Cha: " + Str(RollTheBones(3, 6));
-
-	resultline += ">";
+	AppendText("Dex: ");
+	AppendNumber(RollTheBones(3, 6));
+	AppendText(" Con: ");
+	AppendNumber(RollTheBones(3, 6));
+	AppendText(" Int: ");
+	AppendNumber(RollTheBones(3, 6));
+	AppendText(" Wis: ");
+	AppendNumber(RollTheBones(3, 6));
+	AppendText(" Cha: ");
+	AppendNumber(RollTheBones(3, 6));
+
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -118,55 +130,63 @@ void RollEngine::ScoresDND2()
 	double resultone;
 	double resulttwo;
 	double result;
-	std::string resultline = "<";
+	BeginLine("<");
 
 	/* Handle strength. */
 	resultone = RollTheBones(3, 6);	resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Str: " + Str(result);
+	AppendText("Str: ");
+	AppendNumber(result);
 	if (result == 18)
 	{
-		resultline += "/";
+		AppendText("/");
 		result = RollTheBones(1, 100);
 		if (resultone == 100)
 		{
-			resultline += "00";
+			AppendText("00");
 		}
 		else
 		{
-			convstream << std::setfill('0') << std::setw(2);
-			resultline += Str(result);
-			convstream << std::setw(0);
+			AppendPadded(result, 2);
 		}
 	}
-	resultline += " ";
+	AppendText(" ");
 
 	/* Handle dexterity. */
 	resultone = RollTheBones(3, 6); resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Dex: " + Str(result) + " ";
+	AppendText("Dex: ");
+	AppendNumber(result);
+	AppendText(" ");
 
 	/* Handle constitution. */
 	resultone = RollTheBones(3, 6); resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Con: " + Str(result) + " ";
+	AppendText("Con: ");
+	AppendNumber(result);
+	AppendText(" ");
 
 	/* Handle intelligence. */
 	resultone = RollTheBones(3, 6); resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Int: " + Str(result) + " ";
+	AppendText("Int: ");
+	AppendNumber(result);
+	AppendText(" ");
 
 	/* Handle wisdom. */
 	resultone = RollTheBones(3, 6); resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Wis: " + Str(result) + " ";
+	AppendText("Wis: ");
+	AppendNumber(result);
+	AppendText(" ");
 
 	/* Handle charisma. */
 	resultone = RollTheBones(3, 6); resulttwo = RollTheBones(3, 6);
 	result = (resultone > resulttwo) ? resultone : resulttwo;
-	resultline += "Cha: " + Str(result);
+	AppendText("Cha: ");
+	AppendNumber(result);
 
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -174,14 +194,14 @@ void RollEngine::ScoresDND2()
 
 void RollEngine::ScoresDND3()
 {
-	std::string resultline = "<";
+	BeginLine("<");
 	for (unsigned int i = 0; i < 6; i++)
 	{
-		resultline += Str(RollTheBones(3, 6));
+		AppendNumber(RollTheBones(3, 6));
 		if (i != 5)
-			resultline += " ";
+			AppendText(" ");
 	}
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -189,14 +209,14 @@ void RollEngine::ScoresDND3()
 
 void RollEngine::ScoresDND4()
 {
-	std::string resultline = "<";
+	BeginLine("<");
 	for (unsigned int i = 0; i < 12; i++)
 	{
-		resultline += Str(RollTheBones(3, 6));
+		AppendNumber(RollTheBones(3, 6));
 		if (i != 11)
-			resultline += " ";
+			AppendText(" ");
 	}
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -205,7 +225,7 @@ void RollEngine::ScoresDND4()
 void RollEngine::ScoresDND5()
 {
 	double dice[4];
-	std::string resultline = "<";
+	BeginLine("<");
 	for (unsigned int i = 0; i < 6; i++) 
 	{
 		unsigned int lowest = 0;
@@ -220,11 +240,11 @@ void RollEngine::ScoresDND5()
 		for (unsigned int die = 0; die < 4; die++)
 			if (die != lowest) total += dice[die];
 		
-		resultline += Str(total);
+		AppendNumber(total);
 		if (i != 5)
-			resultline += " ";
+			AppendText(" ");
 	}
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -232,10 +252,13 @@ void RollEngine::ScoresDND5()
 
 void RollEngine::ScoresDND6()
 {
-	std::string resultline = "<Add the following dice to attributes, each starting at 8:";
+	BeginLine("<Add the following dice to attributes, each starting at 8:");
 	for (unsigned int i = 0; i < 7; i++)
-		resultline += " " + Str(RollTheBones(1, 6));
-	resultline += ">";
+	{
+		AppendText(" ");
+		AppendNumber(RollTheBones(1, 6));
+	}
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -243,10 +266,13 @@ void RollEngine::ScoresDND6()
 
 void RollEngine::ScoresDND7()
 {
-	std::string resultline = "<Assign three dice to each attribute:";
+	BeginLine("<Assign three dice to each attribute:");
 	for (unsigned int i = 0; i < 18; i++)
-		resultline += " " + Str(RollTheBones(1, 6));
-	resultline += ">";
+	{
+		AppendText(" ");
+		AppendNumber(RollTheBones(1, 6));
+	}
+	AppendText(">");
 	results->AddMsg(resultline);
 }
 
@@ -254,37 +280,44 @@ void RollEngine::ScoresDND7()
 
 void RollEngine::ScoresNH()
 {
-
-	/* The rest of the parameters are an optional message to be displayed
-	 * with the roll; put them together for such. */
-	std::string message;
-	for (size_t i = 2; i < roll->expression.size(); i++)
-	{
-		message += " " + roll->expression[i];
-	}
-
-	/* Add the title line above the results of the roll. */
-	results->AddMsg("<New Horizons Ability Scores" + For() + ">" + message);
-	std::string resultline = "<";
+	/* Add the title line above the results of the roll, with the rest of
+	 * the parameters as an optional message to be displayed with it. */
+	BeginLine("<New Horizons Ability Scores");
+	AppendFor();
+	AppendText(">");
+	AppendMessage(2);
+	results->AddMsg(resultline);
+	BeginLine("<");
 
 	/* Add most powers. */
-	resultline += "Physical Power: " + Str(RollTheBones(3, 10) + 10) + " "; 
-	resultline += "Psychic Power: " + Str(RollTheBones(3, 10)) + " "; 
-	resultline += "Magic Power: " + Str(RollTheBones(3, 10)) + " ";
+	AppendText("Physical Power: ");
+	AppendNumber(RollTheBones(3, 10) + 10);
+	AppendText(" Psychic Power: ");
+	AppendNumber(RollTheBones(3, 10));
+	AppendText(" Magic Power: ");
+	AppendNumber(RollTheBones(3, 10));
+	AppendText(" ");
 	
 	/* Add alteration power. */
 	double result = RollTheBones(3, 10) - 20; if (result < 0) result = 0;
-	resultline += "Alteration Power: " + Str(result) + " ";
+	AppendText("Alteration Power: ");
+	AppendNumber(result);
+	AppendText(" ");
 
 	/* Add most resistances. */
-	resultline += "Physical Resistance: " + Str(RollTheBones(3, 10)) + " ";
-	resultline += "Psychic Resistance: " + Str(RollTheBones(3, 10)) + " ";
-	resultline += "Magic Resistance: " + Str(RollTheBones(3, 10)) + " ";
+	AppendText("Physical Resistance: ");
+	AppendNumber(RollTheBones(3, 10));
+	AppendText(" Psychic Resistance: ");
+	AppendNumber(RollTheBones(3, 10));
+	AppendText(" Magic Resistance: ");
+	AppendNumber(RollTheBones(3, 10));
+	AppendText(" ");
 
 	/* Add alteration resistance. */
 	result = RollTheBones(3, 10) - 20; if (result < -5) result = -5;
-	resultline += "Alteration Resistance: " + Str(result);
+	AppendText("Alteration Resistance: ");
+	AppendNumber(result);
 
-	resultline += ">";
+	AppendText(">");
 	results->AddMsg(resultline);
 }
@@ -0,0 +1,228 @@
+/* RollEngine's SIM-type roll handling. */
+#include "rollengine.h"
+
+
+
+void RollEngine::DoSimulate()
+{
+	/* Each trial replaces the engine's current roll and results, so hold on
+	 * to the simulation's own. */
+	const Roll& simulation = *roll;
+	RollResults& simulation_results = *results;
+
+	Roll trial;
+	unsigned long trials;
+	if (!PrepareSimulation(simulation, simulation_results, trial, trials))
+		return;
+
+	SimulationTally tally;
+	Simulate(trial, trials, tally);
+	ReportSimulation(simulation, tally, simulation_results);
+}
+
+
+
+bool RollEngine::PrepareSimulation(const Roll& passed_roll, RollResults& passed_results, Roll& trial, unsigned long& trials)
+{
+	roll = &passed_roll;
+	results = &passed_results;
+	results->preset = PRESET_SIMULATION;
+	warning_count = 0;
+	recording = false;
+	generator->BeginRoll(roll->sequence);
+
+	/* Check we have the required number of parameters. */
+	if (roll->expression.size() < 2)
+	{
+		results->Clear();
+		results->AddError("Error: Simulations require an additional parameter specifying the number of trials to run, followed by the roll to simulate.");
+		return false;
+	}
+
+	/* Get the number of trials to run. */
+	double count;
+	if (!ReadExpression(roll->expression[0], count))
+		return false;
+	count = round(count);
+	if (count < 1)
+	{
+		results->AddError("Warning: Simulation specified zero or negative trials to run, and will run one trial instead.");
+
+		count = 1;
+	}
+	if (count > MAX_SIM_TRIALS)
+	{
+		std::string warning = "Warning: Simulation specified " + Str(count) + " trials to run, exceeding the maximum, ";
+		warning += "and was capped at the maximum of " + Str(MAX_SIM_TRIALS) + " trials.";
+		results->AddError(warning);
+
+		count = MAX_SIM_TRIALS;
+	}
+	trials = (unsigned long)count;
+
+	/* Each trial is an ordinary roll with nowhere to send its output. */
+	trial.type = ROLL;
+	trial.outputtype = PLAIN;
+	trial.expression.assign(roll->expression.begin() + 1, roll->expression.end());
+	trial.extra.clear();
+	trial.sequence = roll->sequence;
+
+	/* Perform one trial now, so any errors or warnings for the roll are
+	 * reported once rather than lost among the trials. */
+	RollResults check;
+	Perform(trial, check);
+
+	if (!outcome_recorded)
+		passed_results.Clear();
+
+	for (size_t i = 0; i < check.lines.size(); i++)
+	{
+		if (check.lines[i].type == ERR)
+			passed_results.AddError(check.Text(check.lines[i]));
+	}
+
+	if (!outcome_recorded)
+	{
+		if (passed_results.lines.empty())
+			passed_results.AddError("Error: Only rolls with a single numerical result, such as dice pools, checks and expressions, can be simulated.");
+		return false;
+	}
+
+	/* The expressions a roll evaluates are limited in how costly all the
+	 * trials may be together, as well as each alone, whether the roll is
+	 * a plain expression or a preset taking them as parameters. */
+	if (expression_cost * trials > MAX_SIM_WORK)
+	{
+		std::string error = "Error: The simulation could take up to " + Str(expression_cost * trials);
+		error += " dice and steps to run, exceeding the maximum of ";
+		error += Str(MAX_SIM_WORK);
+		passed_results.Clear();
+		passed_results.AddError(error + "; try fewer trials.");
+		return false;
+	}
+	return true;
+}
+
+
+
+void RollEngine::Simulate(const Roll& trial, unsigned long trials, SimulationTally& tally)
+{
+	RollResults scratch;
+	unsigned long done = 0;
+	recording = false;
+	while (done < trials)
+	{
+		scratch.Clear();
+		Perform(trial, scratch);
+		done++;
+		if (outcome_recorded)
+			tally.Add(outcome, outcome_botched);
+
+		/* A plain expression is left parsed by its trial, so the rest
+		 * of its trials can be evaluated many at once. */
+		if (outcome_expression)
+			break;
+	}
+
+	double values[EVAL_LANES];
+	while (done < trials)
+	{
+		size_t lanes = (size_t)std::min((unsigned long)EVAL_LANES, trials - done);
+		scratch.Clear();
+		warning_count = 0;
+		expression->EvalBatch(lanes, values);
+		done += lanes;
+		for (size_t i = 0; i < lanes; i++)
+			tally.Add(values[i], false);
+	}
+}
+
+
+
+void RollEngine::ReportSimulation(const Roll& passed_roll, const SimulationTally& tally, RollResults& passed_results)
+{
+	roll = &passed_roll;
+	results = &passed_results;
+
+	if (!tally.trials)
+	{
+		results->AddError("Error: None of the simulated rolls had a numerical result.");
+		return;
+	}
+
+	/* The simulated roll is the rest of the parameters. */
+	std::string simulated = roll->expression[1];
+	for (size_t i = 2; i < roll->expression.size(); i++)
+		simulated += " " + roll->expression[i];
+
+	/* Add the summary of the simulation. */
+	std::string line = "<Simulation" + For() + " [" + simulated + "]: Trials: " + Str(tally.trials);
+	line += ", Mean: " + Str(tally.total / tally.trials);
+	if (tally.botches)
+		line += ", Botches: " + Str(::round(tally.botches * 10000.0 / tally.trials) / 100) + "%";
+	results->AddMsg(line + ">");
+
+	/* List the chance of each outcome if there are few enough to fit on a
+	 * line, or the percentiles otherwise. */
+	if (tally.outcomes.size() <= MAX_SIM_OUTCOMES)
+	{
+		line = "<Results: ";
+		for (std::map<double, unsigned long>::const_iterator i = tally.outcomes.begin(); i != tally.outcomes.end(); ++i)
+		{
+			if (i != tally.outcomes.begin())
+				line += ", ";
+			line += Str(i->first) + ": ";
+			line += Str(::round(i->second * 10000.0 / tally.trials) / 100) + "%";
+		}
+		results->AddMsg(line + ">");
+	}
+	else
+	{
+		line = "<Percentiles: 5%: " + Str(tally.Percentile(0.05));
+		line += ", 25%: " + Str(tally.Percentile(0.25));
+		line += ", 50%: " + Str(tally.Percentile(0.5));
+		line += ", 75%: " + Str(tally.Percentile(0.75));
+		line += ", 95%: " + Str(tally.Percentile(0.95)) + ">";
+		results->AddMsg(line);
+	}
+}
+
+
+
+void SimulationTally::Add(double outcome, bool botched)
+{
+	/* NaN has no place in an ordered histogram. */
+	if (outcome != outcome)
+		return;
+
+	trials++;
+	if (botched)
+		botches++;
+	total += outcome;
+	outcomes[outcome]++;
+}
+
+
+
+void SimulationTally::Merge(const SimulationTally& other)
+{
+	trials += other.trials;
+	botches += other.botches;
+	total += other.total;
+	for (std::map<double, unsigned long>::const_iterator i = other.outcomes.begin(); i != other.outcomes.end(); ++i)
+		outcomes[i->first] += i->second;
+}
+
+
+
+double SimulationTally::Percentile(double fraction) const
+{
+	double cumulative = 0;
+	for (std::map<double, unsigned long>::const_iterator i = outcomes.begin(); i != outcomes.end(); ++i)
+	{
+		cumulative += i->second;
+		if (cumulative >= fraction * trials - 1e-9)
+			return i->first;
+	}
+	return outcomes.rbegin()->first;
+}
@@ -2,338 +2,1182 @@
 #include "rollengine.h"
 
 
-void ExpressionParser::Parse(const char *expression_string)
+/* The constants and functions. These must be kept sorted by name, in strcmp()
+ * order, for ReadToken() to find them. */
+const ExpTextToken ExpressionParser::TextTokens[] = {
+	{ "abs(",    FUNCTION, 0,    &RollEngine::abs },
+	{ "acos(",   FUNCTION, 0,    &RollEngine::acos },
+	{ "asin(",   FUNCTION, 0,    &RollEngine::asin },
+	{ "atan(",   FUNCTION, 0,    &RollEngine::atan },
+	{ "ceil(",   FUNCTION, 0,    &RollEngine::ceil },
+	{ "cos(",    FUNCTION, 0,    &RollEngine::cos },
+	{ "cosh(",   FUNCTION, 0,    &RollEngine::cosh },
+	{ "deg(",    FUNCTION, 0,    &RollEngine::deg },
+	{ "exp(",    FUNCTION, 0,    &RollEngine::exp },
+	{ "fac(",    FUNCTION, 0,    &RollEngine::fac },
+	{ "floor(",  FUNCTION, 0,    &RollEngine::floor },
+	{ "i",       NUMBER,   1,    NULL },
+	{ "ii",      NUMBER,   2,    NULL },
+	{ "iii",     NUMBER,   3,    NULL },
+	{ "iv",      NUMBER,   4,    NULL },
+	{ "ix",      NUMBER,   9,    NULL },
+	{ "log(",    FUNCTION, 0,    &RollEngine::log },
+	{ "log10(",  FUNCTION, 0,    &RollEngine::log10 },
+	{ "logten(", FUNCTION, 0,    &RollEngine::log10 }, /* Alias. */
+	{ "pi",      NUMBER,   M_PI, NULL },
+	{ "rad(",    FUNCTION, 0,    &RollEngine::rad },
+	{ "ran(",    RANDOM,   0,    NULL },
+	{ "round(",  FUNCTION, 0,    &RollEngine::round },
+	{ "sin(",    FUNCTION, 0,    &RollEngine::sin },
+	{ "sinh(",   FUNCTION, 0,    &RollEngine::sinh },
+	{ "sqr(",    FUNCTION, 0,    &RollEngine::sqr },
+	{ "sqrt(",   FUNCTION, 0,    &RollEngine::sqrt },
+	{ "tan(",    FUNCTION, 0,    &RollEngine::tan },
+	{ "tanh(",   FUNCTION, 0,    &RollEngine::tanh },
+	{ "todeg(",  FUNCTION, 0,    &RollEngine::deg },   /* Alias. */
+	{ "trunc(",  FUNCTION, 0,    &RollEngine::trunc },
+	{ "v",       NUMBER,   5,    NULL },
+	{ "vi",      NUMBER,   6,    NULL },
+	{ "vii",     NUMBER,   7,    NULL },
+	{ "viii",    NUMBER,   8,    NULL },
+	{ "x",       NUMBER,   10,   NULL },
+};
+const size_t ExpressionParser::TextTokenCount = sizeof(TextTokens) / sizeof(TextTokens[0]);
+
+/* The precedence of each operator, indexed by token type. Higher precedences
+ * bind more tightly, and all the binary operators group left to right.
+ * Everything else has no precedence, so parentheses and functions on the
+ * operator stack are never popped by operators. */
+static const int Precedence[] = {
+	1, 1,    /* ADD, SUBTRACT */
+	2, 2, 2, /* MULTIPLY, DIVIDE, MODULO */
+	3,       /* EXPONENT */
+	4,       /* UMINUS */
+	5,       /* DICE */
+	0, 0, 0, 0, 0, 0,
+	0
+};
+
+/* The handler for each token type, indexed by token type. */
+const EvalHandler ExpressionParser::Handlers[] = {
+	&ExpressionParser::EvalAdd, &ExpressionParser::EvalSubtract,
+	&ExpressionParser::EvalMultiply, &ExpressionParser::EvalDivide, &ExpressionParser::EvalModulo,
+	&ExpressionParser::EvalExponent,
+	&ExpressionParser::EvalNegate,
+	&ExpressionParser::EvalDice,
+	&ExpressionParser::EvalNumber, &ExpressionParser::EvalFunction, &ExpressionParser::EvalRandom, NULL, NULL, NULL,
+	NULL
+};
+
+/* The handler for each binary operator with its right-hand number inlined,
+ * indexed by token type. Other token types can't take an inlined number. */
+const EvalHandler ExpressionParser::InlinedHandlers[] = {
+	&ExpressionParser::EvalAddNumber, &ExpressionParser::EvalSubtractNumber,
+	&ExpressionParser::EvalMultiplyNumber, &ExpressionParser::EvalDivideNumber, &ExpressionParser::EvalModuloNumber,
+	&ExpressionParser::EvalExponentNumber,
+	NULL,
+	&ExpressionParser::EvalDiceNumber,
+	NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL
+};
+
+/* The integer handlers for whole number expressions, indexed by token type,
+ * plainly and with the right-hand number inlined. Division, exponents and
+ * functions never appear in those. Dice rolls known to be within limits are
+ * handled separately. */
+const IntegerEvalHandler ExpressionParser::IntegerHandlers[] = {
+	&ExpressionParser::IntegerAdd, &ExpressionParser::IntegerSubtract,
+	&ExpressionParser::IntegerMultiply, NULL, &ExpressionParser::IntegerModulo,
+	NULL,
+	&ExpressionParser::IntegerNegate,
+	&ExpressionParser::IntegerDice,
+	&ExpressionParser::IntegerNumber, NULL, &ExpressionParser::IntegerRandom, NULL, NULL, NULL,
+	NULL
+};
+const IntegerEvalHandler ExpressionParser::IntegerInlinedHandlers[] = {
+	&ExpressionParser::IntegerAddNumber, &ExpressionParser::IntegerSubtractNumber,
+	&ExpressionParser::IntegerMultiplyNumber, NULL, &ExpressionParser::IntegerModuloNumber,
+	NULL,
+	NULL,
+	&ExpressionParser::IntegerDiceNumber,
+	NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL
+};
+
+
+
+bool ExpressionParser::Parse(const char *expression_string)
+{
+	/* Use the compiled expression from the cache if it's there, moving it
+	 * to the front as the most recently used. */
+	if (CacheCapacity)
+	{
+		ExpressionCacheIndex::iterator cached = CacheIndex.find(expression_string);
+		if (cached != CacheIndex.end())
+		{
+			CacheHits++;
+			Cache.splice(Cache.begin(), Cache, cached->second);
+			Program = &cached->second->tokens[0];
+			ProgramLength = cached->second->tokens.size();
+			Code = &cached->second->code[0];
+			CodeLength = cached->second->code.size();
+			Cost = cached->second->cost;
+			Integral = cached->second->integral;
+			return true;
+		}
+		CacheMisses++;
+	}
+
+	if (!ParseExpression(expression_string))
+		return false;
+	Compile();
+
+	Program = Expression;
+	ProgramLength = ExpressionLength;
+	Code = Compiled;
+	CodeLength = CompiledLength;
+	if (CacheCapacity)
+		CacheExpression(expression_string);
+	return true;
+}
+
+
+bool ExpressionParser::Validate(const char *expression_string)
+{
+	ProgramLength = 0;
+	CodeLength = 0;
+	return ParseExpression(expression_string);
+}
+
+
+bool ExpressionParser::ParseExpression(const char *expression_string)
 {
 	/* Reset the expression. */
 	string = expression_string;
 	ParsePosition = string;
-	ParseStackDepth = 0;
 	ExpressionLength = 0;
+	OperatorDepth = 0;
 
 	/* Reset the current token to END, which as a previous token indicates
 	 * the start when examined for contextual information. */
 	CurrentToken.token.type = END;
 
-	/* Read the first token and start parsing. This returns once the end is
-	 * reached. */
-	ReadToken();
-	Level1();
-
-	/* If we're not at the end of the string, we've 'junk' after the
-	 * expression. */
-	if (CurrentToken.token.type != END)
+	/* Read the first token and start parsing. Tokens alternate between
+	 * operands, with any unary minuses before them, and the operators
+	 * between them. Operators wait on the operator stack until one which
+	 * binds no more tightly comes along, and parentheses and functions
+	 * wait there until their closing parenthesis. */
+	if (!ReadToken())
+		return false;
+	bool operand = true;
+	bool dice_sides = false; /* The operand is a dice roll's sides. */
+	while (1)
 	{
-		if (CurrentToken.token.type == CPAREN)
-			ThrowParseError("Unmatched closing parenthesis:");
-		else
-			ThrowParseError("Invalid token for this position in expression:");
+		ExpTokenType type = CurrentToken.token.type;
+
+		if (operand)
+		{
+			/* Handle numbers. */
+			if (type == NUMBER)
+			{
+				if (!AddToken(CurrentToken) || !ReadToken())
+					return false;
+				operand = false;
+				continue;
+			}
+
+			/* Handle unary minus, which binds less tightly than
+			 * dice, so can't be used on their sides. */
+			if (type == UMINUS && !dice_sides)
+			{
+				if (!PushOperator(CurrentToken) || !ReadToken())
+					return false;
+				continue;
+			}
+
+			/* Handle parenthesis and functions. */
+			if (type == OPAREN || type == FUNCTION || type == RANDOM)
+			{
+				ExpToken OurToken = CurrentToken;
+				if (!ReadToken())
+					return false;
+				if (CurrentToken.token.type == CPAREN)
+				{
+					if (type == OPAREN)
+						return ParseError("Missing expression in parenthesis:");
+					else
+						return ParseError("Missing parameter for function:");
+				}
+
+				if (!PushOperator(OurToken))
+					return false;
+				dice_sides = false;
+				continue;
+			}
+
+			/* Reaching end of string here means we were looking for
+			 * a value for an operator, but the string is missing
+			 * one. */
+			if (type == END)
+				return ParseError("End of expression when a number or equivalent was expected:");
+
+			/* Otherwise, this is a generic "wanted an number/similar,
+			 * but didn't get one" scenario. */
+			return ParseError("Expected number or equivalent:");
+		}
+
+		/* Handle binary operators, adding those waiting which bind at
+		 * least as tightly first. */
+		if (Precedence[type] && type != UMINUS)
+		{
+			if (!PopOperators(Precedence[type]) || !PushOperator(CurrentToken) || !ReadToken())
+				return false;
+			operand = true;
+			dice_sides = type == DICE;
+			continue;
+		}
+
+		/* Handle dice modifiers, which change the dice roll whose sides
+		 * were just read, still waiting on the operator stack. */
+		if (type == MODIFIER)
+		{
+			if (!OperatorDepth || OperatorStack[OperatorDepth-1].token.type != DICE)
+				return ParseError("Dice modifier not directly after the sides of a dice roll:");
+
+			ExpDiceModifiers& dice = OperatorStack[OperatorDepth-1].dice.modifiers;
+			const ExpDiceModifiers& modifier = CurrentToken.dice.modifiers;
+			if (modifier.reroll)
+			{
+				if (dice.reroll)
+					return ParseError("More than one reroll modifier for a dice roll:");
+				dice.reroll = modifier.reroll;
+			}
+			if (modifier.explode)
+			{
+				if (dice.explode)
+					return ParseError("More than one exploding modifier for a dice roll:");
+				dice.explode = true;
+			}
+			if (modifier.selection)
+			{
+				if (dice.selection)
+					return ParseError("More than one keep or drop modifier for a dice roll:");
+				dice.selection = modifier.selection;
+				dice.select = modifier.select;
+			}
+			if (modifier.success)
+			{
+				if (dice.success)
+					return ParseError("More than one success counting modifier for a dice roll:");
+				dice.success = modifier.success;
+			}
+			if (!ReadToken())
+				return false;
+			continue;
+		}
+
+		/* Anything else ends the innermost parenthesis or function, or
+		 * the expression, once all the operators in it are added. */
+		if (!PopOperators(1))
+			return false;
+		if (OperatorDepth)
+		{
+			if (type != CPAREN)
+				return ParseError("Missing closing parenthesis:");
+
+			OperatorDepth--;
+			if (OperatorStack[OperatorDepth].token.type != OPAREN && !AddToken(OperatorStack[OperatorDepth]))
+				return false;
+			if (!ReadToken())
+				return false;
+			continue;
+		}
+
+		/* If we're not at the end of the string, we've 'junk' after
+		 * the expression. */
+		if (type == CPAREN)
+			return ParseError("Unmatched closing parenthesis:");
+		else if (type != END)
+			return ParseError("Invalid token for this position in expression:");
+		break;
 	}
+
+	Fold();
+	return Analyse();
 }
 
 
-void ExpressionParser::Level1()
+void ExpressionParser::Fold()
 {
-	StackDepthCounter sdc(this);
+	/* Walk the expression as Eval() would, but with a stack recording
+	 * only whether each value is constant. Constant values are always
+	 * single NUMBER tokens, and the values on top of the stack are always
+	 * the last ones written, so an operator on constants replaces the
+	 * tokens it would have popped with its result. Operations which give
+	 * NaN are left to Eval(); which sign it gives a NaN depends on the
+	 * order its compiled code takes the operands in, so folding them could
+	 * change the result shown. */
+	bool constant[MAX_NUM_STACK];
+	size_t depth = 0;
+	size_t length = 0;
 
-	Level2();
-	while (CurrentToken.token.type == ADD || CurrentToken.token.type == SUBTRACT)
+	for (size_t i = 0; i < ExpressionLength; ++i)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		Level2();
-		AddToken(OurToken);
+		ExpToken& token = Expression[i];
+		ExpTokenType type = token.token.type;
+
+		if (type == NUMBER)
+		{
+			Expression[length++] = token;
+			constant[depth++] = true;
+			continue;
+		}
+
+		/* Unary operators and functions. ran() rolls a die, so it stays. */
+		if (type == UMINUS || type == FUNCTION)
+		{
+			if (constant[depth-1])
+			{
+				double& value = Expression[length-1].number.value;
+				double result = type == UMINUS ? -value : token.function.pointer(value);
+				if (result == result)
+				{
+					value = result;
+					continue;
+				}
+			}
+			Expression[length++] = token;
+			constant[depth-1] = false;
+			continue;
+		}
+		if (type == RANDOM)
+		{
+			Expression[length++] = token;
+			constant[depth-1] = false;
+			continue;
+		}
+
+		/* Binary operators. Dice always stay. */
+		depth--;
+		if (!constant[depth-1] || !constant[depth] || type == DICE)
+		{
+			Expression[length++] = token;
+			constant[depth-1] = false;
+			continue;
+		}
+
+		double left = Expression[length-2].number.value;
+		double right = Expression[length-1].number.value;
+		double result = 0;
+		if (type == ADD)
+			result = left + right;
+		else if (type == SUBTRACT)
+			result = left - right;
+		else if (type == MULTIPLY)
+			result = left * right;
+		else if (type == DIVIDE)
+			result = left / right;
+		else if (type == MODULO)
+			result = ExpModulo(left, right);
+		else if (type == EXPONENT)
+			result = pow(left, right);
+
+		if (result != result)
+		{
+			Expression[length++] = token;
+			constant[depth-1] = false;
+			continue;
+		}
+		length--;
+		Expression[length-1].number.value = result;
 	}
+
+	ExpressionLength = length;
 }
 
 
-void ExpressionParser::Level2()
+/* The bounds of the four results of applying an operator to the ends of the
+ * bounds of its operands. */
+static ExpBounds CornerBounds(double a, double b, double c, double d)
 {
-	StackDepthCounter sdc(this);
+	ExpBounds bounds(std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)));
+	if (a != a || b != b || c != c || d != d)
+		bounds.Unbound();
+	return bounds;
+}
+
+
 
-	Level3();
-	while (CurrentToken.token.type == MULTIPLY || CurrentToken.token.type == DIVIDE || CurrentToken.token.type == MODULO)
+/* Functions which never decrease are just applied to the ends of the bounds
+ * of their argument. */
+ExpBounds ExpressionParser::FunctionBounds(ExpMathFunc function, const ExpBounds& x)
+{
+	if (function == &RollEngine::abs || function == &RollEngine::sqr)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		Level3();
-		AddToken(OurToken);
+		double low = x.low > 0 ? x.low : x.high < 0 ? -x.high : 0;
+		double high = x.Magnitude();
+		if (function == &RollEngine::sqr)
+			return ExpBounds(low * low, high * high);
+		return ExpBounds(low, high);
 	}
+	if (function == &RollEngine::sin || function == &RollEngine::cos)
+		return ExpBounds(-1, 1);
+	if (function == &RollEngine::acos)
+		return ExpBounds(0, M_PI);
+	if (function == &RollEngine::cosh)
+		return ExpBounds(1, ::cosh(x.Magnitude()));
+	if (function == &RollEngine::tan)
+		return ExpBounds(-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+
+	return ExpBounds(function(x.low), function(x.high));
 }
 
 
-void ExpressionParser::Level3()
+
+bool ExpressionParser::Analyse()
 {
-	StackDepthCounter sdc(this);
+	/* Walk the expression as Eval() would, but with a stack of the
+	 * bounds of each value, adding up the most work each token could
+	 * take. Dice rolls take a step for each die, and factorials one for
+	 * each number multiplied, which stops once the result overflows.
+	 *
+	 * The expression is integral if it starts from whole numbers and only
+	 * uses operations which give whole numbers from them, with no value
+	 * ever too big for a double to hold exactly; double arithmetic then
+	 * gives exactly the results integer arithmetic does. */
+	ExpBounds stack[MAX_NUM_STACK];
+	size_t depth = 0;
+	Cost = 0;
+	Integral = true;
 
-	Level4();
-	while (CurrentToken.token.type == EXPONENT)
+	for (size_t i = 0; i < ExpressionLength; ++i)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		Level4();
-		AddToken(OurToken);
+		ExpTokenType type = Expression[i].token.type;
+		Cost++;
+
+		if (type == NUMBER)
+		{
+			double value = Expression[i].number.value;
+			stack[depth++] = ExpBounds(value, value);
+			if (::round(value) != value || ::fabs(value) > MAX_EXACT_INTEGER)
+				Integral = false;
+			continue;
+		}
+
+		/* Unary operators and functions. */
+		ExpBounds& x = stack[depth-1];
+		if (type == UMINUS)
+		{
+			x = ExpBounds(-x.high, -x.low);
+			continue;
+		}
+		if (type == FUNCTION)
+		{
+			if (Expression[i].function.pointer == &RollEngine::fac)
+				Cost += std::min(std::max(::round(x.high), 0.0), 171.0);
+			x = FunctionBounds(Expression[i].function.pointer, x);
+			Integral = false;
+			continue;
+		}
+		if (type == RANDOM)
+		{
+			/* ran() rolls one die of up to UINT_MAX sides. */
+			bool fits = x.low >= 0 && x.high <= UINT_MAX;
+			double sides = fits ? x.high : UINT_MAX;
+			x = ExpBounds(1, std::max(::floor(sides), 1.0));
+			if (!fits)
+				Integral = false;
+			continue;
+		}
+
+		/* Binary operators. */
+		depth--;
+		ExpBounds& left = stack[depth-1];
+		const ExpBounds& right = stack[depth];
+
+		if (type == DICE)
+		{
+			/* CheckDice() turns counts out of range into the most dice
+			 * allowed, and limits the sides. */
+			double count = left.low >= 0 && left.high <= 10000 ? ::round(left.high) : 10000;
+			double fewest = left.low >= 0 && left.high <= 10000 ? ::round(left.low) : 0;
+			double sides = std::min(std::max(::round(right.high), 1.0), 10000.0);
+			Cost += count;
+			Expression[i].dice.within_limits = left.low >= 0 && left.high <= 10000 && right.low >= 1 && right.high <= 10000;
+			const ExpDiceModifiers& modifiers = Expression[i].dice.modifiers;
+			if (modifiers.success)
+				left = ExpBounds(0, count);
+			else if (modifiers.Any())
+				left = ExpBounds(0, count * sides * (modifiers.explode ? MAX_DICE_EXPLOSIONS + 1 : 1));
+			else
+				left = ExpBounds(fewest, count * sides);
+		}
+		else if (type == ADD)
+			left = ExpBounds(left.low + right.low, left.high + right.high);
+		else if (type == SUBTRACT)
+			left = ExpBounds(left.low - right.high, left.high - right.low);
+		else if (type == MULTIPLY)
+			left = CornerBounds(left.low * right.low, left.low * right.high, left.high * right.low, left.high * right.high);
+		else if (type == DIVIDE)
+		{
+			Integral = false;
+			if (right.low <= 0 && right.high >= 0)
+				left.Unbound();
+			else
+				left = CornerBounds(left.low / right.low, left.low / right.high, left.high / right.low, left.high / right.high);
+		}
+		else if (type == MODULO)
+		{
+			/* The result is no bigger than either operand. Dividing by
+			 * zero gives NaN, which isn't a whole number. */
+			if (right.low <= 0 && right.high >= 0)
+				Integral = false;
+			double magnitude = std::min(left.Magnitude(), right.Magnitude());
+			left = ExpBounds(-magnitude, magnitude);
+		}
+		else if (type == EXPONENT)
+		{
+			/* The magnitude of a power only grows or shrinks with the
+			 * magnitudes of the base and the exponent, so the biggest
+			 * comes from the ends of them. */
+			double smallest = left.low > 0 ? left.low : left.high < 0 ? -left.high : 0;
+			double largest = left.Magnitude();
+			double magnitude = std::max(std::max(::fabs(pow(smallest, right.low)), ::fabs(pow(smallest, right.high))),
+				std::max(::fabs(pow(largest, right.low)), ::fabs(pow(largest, right.high))));
+			left = ExpBounds(-magnitude, magnitude);
+			Integral = false;
+		}
+
+		if (stack[depth-1].Magnitude() > MAX_EXACT_INTEGER)
+			Integral = false;
 	}
+
+	if (Cost > MAX_EXP_COST)
+	{
+		std::string message = "Error: The expression could take up to ";
+		message += engine->Str(Cost);
+		message += " dice and steps to evaluate, exceeding the maximum of ";
+		message += engine->Str(MAX_EXP_COST);
+		message += ".";
+		engine->results->Clear();
+		engine->results->AddError(message);
+		return false;
+	}
+	return true;
 }
 
 
-void ExpressionParser::Level4()
+void ExpressionParser::SetCacheCapacity(size_t capacity)
 {
-	StackDepthCounter sdc(this);
+	CacheCapacity = capacity;
+	while (CacheIndex.size() > CacheCapacity)
+	{
+		CacheIndex.erase(Cache.back().text.c_str());
+		Cache.pop_back();
+	}
+}
 
-	if (CurrentToken.token.type == UMINUS)
+
+void ExpressionParser::CacheExpression(const char* expression_string)
+{
+	/* Reuse the least recently used entry if the cache is full. Its text
+	 * must be dropped from the index before it changes. */
+	if (CacheIndex.size() >= CacheCapacity)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		Level4();  /* Allow for multiple unary minuses. */
-		AddToken(OurToken);
+		CacheIndex.erase(Cache.back().text.c_str());
+		Cache.splice(Cache.begin(), Cache, --Cache.end());
 	}
 	else
-		Level5();
+		Cache.push_front(CachedExpression());
+
+	CachedExpression& entry = Cache.front();
+	entry.text = expression_string;
+	entry.tokens.assign(Expression, Expression + ExpressionLength);
+	entry.code.assign(Compiled, Compiled + CompiledLength);
+	entry.cost = Cost;
+	entry.integral = Integral;
+	CacheIndex[entry.text.c_str()] = Cache.begin();
 }
 
 
-void ExpressionParser::Level5()
+bool ExpressionParser::PushOperator(ExpToken& token)
 {
-	Level6();
-	while (CurrentToken.token.type == DICE)
+	if (OperatorDepth >= MAX_OPERATOR_STACK)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		Level6();
-		AddToken(OurToken);
+		return ParseError("Maximum operator depth exceeded (expression too long or complex):");
 	}
+
+	OperatorStack[OperatorDepth] = token;
+	OperatorDepth++;
+	return true;
 }
 
 
-void ExpressionParser::Level6()
+bool ExpressionParser::PopOperators(int precedence)
 {
-	StackDepthCounter sdc(this);
+	while (OperatorDepth && Precedence[OperatorStack[OperatorDepth-1].token.type] >= precedence)
+	{
+		OperatorDepth--;
+		if (!AddToken(OperatorStack[OperatorDepth]))
+			return false;
+	}
+	return true;
+}
 
-	/* Handle numbers. */
-	if (CurrentToken.token.type == NUMBER)
+
+bool ExpressionParser::AddToken(ExpToken& token)
+{
+	if (ExpressionLength >= MAX_EXP_TOKENS)
 	{
-		AddToken(CurrentToken);
-		ReadToken();
+		return ParseError("Maximum expression tokens exceeded (expression too long or complex):");
+	}
+
+	Expression[ExpressionLength] = token;
+	ExpressionLength++;
+	return true;
+}
+
+
+void ExpressionParser::Compile()
+{
+	/* Each token becomes the operation its handler performs, except that a
+	 * number followed by a binary operator is always that operator's
+	 * right-hand operand, so it is inlined into the operator instead of
+	 * being pushed and popped straight away. */
+	if (Integral)
+	{
+		CompileIntegral();
 		return;
 	}
 
-	/* Handle parenthesis. */
-	if (CurrentToken.token.type == OPAREN)
+	CompiledLength = 0;
+	for (size_t i = 0; i < ExpressionLength; ++i)
 	{
-		ReadToken();
-		if (CurrentToken.token.type == CPAREN)
-			ThrowParseError("Missing expression in parenthesis:");
-	
-		Level1();
+		ExpTokenType type = Expression[i].token.type;
+		EvalOp& op = Compiled[CompiledLength];
+		CompiledLength++;
 
-		if (CurrentToken.token.type != CPAREN)
-			ThrowParseError("Missing closing parenthesis:");
-		
-		ReadToken();
-		return;
+		/* Dice rolls with modifiers hold those instead of an inlined number. */
+		ExpTokenType next = i + 1 < ExpressionLength ? Expression[i+1].token.type : END;
+		if (next == DICE && Expression[i+1].dice.modifiers.Any())
+			next = END;
+
+		if (type == NUMBER && InlinedHandlers[next])
+		{
+			op.handler = InlinedHandlers[next];
+			op.value = Expression[i].number.value;
+			++i;
+		}
+		else
+		{
+			op.handler = Handlers[type];
+			if (type == NUMBER)
+				op.value = Expression[i].number.value;
+			else if (type == FUNCTION)
+				op.function = Expression[i].function.pointer;
+			else if (type == DICE && Expression[i].dice.modifiers.Any())
+			{
+				op.handler = &ExpressionParser::EvalModifiedDice;
+				op.modifiers = Expression[i].dice.modifiers;
+			}
+		}
 	}
+}
+
 
-	/* Handle functions. */
-	if (CurrentToken.token.type == FUNCTION)
+void ExpressionParser::CompileIntegral()
+{
+	/* As Compile(), with the integer handlers. */
+	CompiledLength = 0;
+	for (size_t i = 0; i < ExpressionLength; ++i)
 	{
-		ExpToken OurToken = CurrentToken;
-		ReadToken();
-		if (CurrentToken.token.type == CPAREN)
-			ThrowParseError("Missing parameter for function:");
-	
-		Level1();
+		ExpTokenType type = Expression[i].token.type;
+		EvalOp& op = Compiled[CompiledLength];
+		CompiledLength++;
 
-		if (CurrentToken.token.type != CPAREN)
-			ThrowParseError("Missing closing parenthesis:");
-		
-		AddToken(OurToken);
-		ReadToken();
-		return;
+		ExpTokenType next = i + 1 < ExpressionLength ? Expression[i+1].token.type : END;
+		bool plain_dice = next == DICE && !Expression[i+1].dice.modifiers.Any();
+		if (next == DICE && !plain_dice)
+			next = END;
+
+		if (type == NUMBER && IntegerInlinedHandlers[next])
+		{
+			op.integer_handler = IntegerInlinedHandlers[next];
+			if (plain_dice && Expression[i+1].dice.within_limits)
+				op.integer_handler = &ExpressionParser::IntegerDiceWithinLimitsNumber;
+			op.integer = (int64_t)Expression[i].number.value;
+			++i;
+		}
+		else
+		{
+			op.integer_handler = IntegerHandlers[type];
+			if (type == NUMBER)
+				op.integer = (int64_t)Expression[i].number.value;
+			else if (type == DICE && Expression[i].dice.modifiers.Any())
+			{
+				op.integer_handler = &ExpressionParser::IntegerModifiedDice;
+				op.modifiers = Expression[i].dice.modifiers;
+			}
+			else if (type == DICE && Expression[i].dice.within_limits)
+				op.integer_handler = &ExpressionParser::IntegerDiceWithinLimits;
+		}
 	}
+}
 
-	/* Reaching end of string here means we were looking for a value for
-	 * an operator above, but the string is missing one. */
-	if (CurrentToken.token.type == END)
-		ThrowParseError("End of expression when a number or equivalent was expected:");
 
-	/* Otherwise, this is a generic "wanted an number/similar, but didn't
-	 * get one" scenario. */
-	ThrowParseError("Expected number or equivalent:");
+double ExpressionParser::Eval() {
+	/* Whole number expressions run on the integer stack instead, with
+	 * no negative zeroes to worry about. */
+	if (Integral)
+	{
+		int64_t* top = IntegerStack;
+		for (const EvalOp* op = Code; op != Code + CodeLength; ++op)
+			top = op->integer_handler(top, *op, engine);
+		return (double)IntegerStack[0];
+	}
+
+	/* Run each operation's handler in turn, passing the top of the stack
+	 * from one to the next. */
+	double* top = EvalStack;
+	for (const EvalOp* op = Code; op != Code + CodeLength; ++op)
+		top = op->handler(top, *op, engine);
+
+	/* Return any zero result as positive zero, never negative. */
+	if (EvalStack[0] == 0)
+		return 0;
+	
+	/* Return the result. */
+	return EvalStack[0];
 }
 
 
-void ExpressionParser::AddToken(ExpToken& token)
+void ExpressionParser::EvalBatch(size_t count, double* results)
 {
-	if (ExpressionLength >= MAX_EXP_TOKENS)
+	/* Make room on the batch stack for the deepest the expression goes. */
+	size_t depth = 0;
+	size_t deepest = 0;
+	for (size_t i = 0; i < ProgramLength; ++i)
 	{
-		ThrowParseError("Maximum expression tokens exceeded (expression too long or complex):");
+		ExpTokenType type = Program[i].token.type;
+		if (type == NUMBER)
+			deepest = std::max(deepest, ++depth);
+		else if (Precedence[type] && type != UMINUS)
+			depth--;
 	}
+	if (BatchStack.size() < deepest * EVAL_LANES)
+		BatchStack.resize(deepest * EVAL_LANES);
 
-	Expression[ExpressionLength] = token;
-	ExpressionLength++;
+	for (size_t done = 0; done < count; done += EVAL_LANES)
+		EvalLanes(std::min((size_t)EVAL_LANES, count - done), results + done);
 }
 
 
-double ExpressionParser::Eval() {
-	EvalPosition = 0;
-	for (size_t i = 0; i < ExpressionLength; ++i)
+void ExpressionParser::EvalLanes(size_t lanes, double* results)
+{
+	/* Each number on the stack is a row of EVAL_LANES values, one for each
+	 * trial. Arithmetic runs across whole rows, used lanes or not, so the
+	 * compiler can vectorise the fixed length loops; everything which rolls
+	 * dice, could trap, or is costly only runs across the lanes in use. */
+	double* top = &BatchStack[0];
+	for (size_t i = 0; i < ProgramLength; ++i)
 	{
-		if (Expression[i].token.type == NUMBER)
+		ExpTokenType type = Program[i].token.type;
+		double* left = top - 2 * EVAL_LANES;
+		double* right = top - EVAL_LANES;
+
+		if (type == NUMBER)
+		{
+			std::fill(top, top + EVAL_LANES, Program[i].number.value);
+			top += EVAL_LANES;
+		}
+
+		else if (type == ADD)
 		{
-			EvalStack[EvalPosition] = Expression[i].number.value;
-			EvalPosition++;
+			for (size_t lane = 0; lane < EVAL_LANES; lane++)
+				left[lane] += right[lane];
+			top = right;
 		}
 
-		else if (Expression[i].token.type == ADD)
+		else if (type == SUBTRACT)
 		{
-			EvalStack[EvalPosition-2] += EvalStack[EvalPosition-1];
-			EvalPosition--;
+			for (size_t lane = 0; lane < EVAL_LANES; lane++)
+				left[lane] -= right[lane];
+			top = right;
 		}
 
-		else if (Expression[i].token.type == SUBTRACT)
+		else if (type == MULTIPLY)
 		{
-			EvalStack[EvalPosition-2] -= EvalStack[EvalPosition-1];
-			EvalPosition--;
+			for (size_t lane = 0; lane < EVAL_LANES; lane++)
+				left[lane] *= right[lane];
+			top = right;
 		}
 
-		else if (Expression[i].token.type == MULTIPLY)
+		else if (type == DIVIDE)
 		{
-			EvalStack[EvalPosition-2] *= EvalStack[EvalPosition-1];
-			EvalPosition--;
+			for (size_t lane = 0; lane < EVAL_LANES; lane++)
+				left[lane] /= right[lane];
+			top = right;
 		}
 
-		else if (Expression[i].token.type == DIVIDE)
+		else if (type == MODULO)
 		{
-			EvalStack[EvalPosition-2] /= EvalStack[EvalPosition-1];
-			EvalPosition--;
+			for (size_t lane = 0; lane < lanes; lane++)
+				left[lane] = ExpModulo(left[lane], right[lane]);
+			top = right;
 		}
 
-		else if (Expression[i].token.type == MODULO)
+		else if (type == EXPONENT)
 		{
-			EvalStack[EvalPosition-2] = (int)EvalStack[EvalPosition-2] % (int)EvalStack[EvalPosition-1];
-			EvalPosition--;
+			for (size_t lane = 0; lane < lanes; lane++)
+				left[lane] = pow(left[lane], right[lane]);
+			top = right;
 		}
 
-		else if (Expression[i].token.type == EXPONENT)
+		else if (type == UMINUS)
 		{
-			EvalStack[EvalPosition-2] = pow(EvalStack[EvalPosition-2], EvalStack[EvalPosition-1]);
-			EvalPosition--;
+			for (size_t lane = 0; lane < EVAL_LANES; lane++)
+				right[lane] = -right[lane];
 		}
 
-		else if (Expression[i].token.type == UMINUS)
-			EvalStack[EvalPosition-1] = -EvalStack[EvalPosition-1];
+		else if (type == DICE)
+		{
+			if (Program[i].dice.modifiers.Any())
+			{
+				for (size_t lane = 0; lane < lanes; lane++)
+				{
+					engine->holding_lane = lane;
+					left[lane] = engine->RollModifiedDice(left[lane], right[lane], Program[i].dice.modifiers);
+				}
+			}
+			else
+				engine->RollTheBones(left, right, lanes);
+			top = right;
+		}
 
-		else if (Expression[i].token.type == DICE)
+		else if (type == FUNCTION)
 		{
-			EvalStack[EvalPosition-2] = engine->RollTheBones(EvalStack[EvalPosition-2], EvalStack[EvalPosition-1]);
-			EvalPosition--;
+			for (size_t lane = 0; lane < lanes; lane++)
+				right[lane] = Program[i].function.pointer(right[lane]);
 		}
 
-		else if (Expression[i].token.type == FUNCTION)
+		else if (type == RANDOM)
 		{
-			EvalStack[EvalPosition-1] = (engine->*Expression[i].function.pointer)(EvalStack[EvalPosition-1]);
+			for (size_t lane = 0; lane < lanes; lane++)
+				right[lane] = engine->ran(right[lane]);
 		}
 	}
 
 	/* Return any zero result as positive zero, never negative. */
-	if (EvalStack[0] == 0)
-		return 0;
-	
-	/* Return the result. */
-	return EvalStack[0];
+	for (size_t lane = 0; lane < lanes; lane++)
+		results[lane] = BatchStack[lane] == 0 ? 0 : BatchStack[lane];
+}
+
+
+/* Evaluation handlers. Binary operators take their left-hand operand from
+ * the stack below their right-hand one, or below the top if the right-hand
+ * one is inlined. */
+double* ExpressionParser::EvalNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	*top = op.value;
+	return top + 1;
+}
+
+double* ExpressionParser::EvalAdd(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] += top[-1];
+	return top - 1;
+}
+
+double* ExpressionParser::EvalSubtract(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] -= top[-1];
+	return top - 1;
+}
+
+double* ExpressionParser::EvalMultiply(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] *= top[-1];
+	return top - 1;
+}
+
+double* ExpressionParser::EvalDivide(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] /= top[-1];
+	return top - 1;
+}
+
+double* ExpressionParser::EvalModulo(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] = ExpModulo(top[-2], top[-1]);
+	return top - 1;
+}
+
+double* ExpressionParser::EvalExponent(double* top, const EvalOp&, RollEngine*)
+{
+	top[-2] = pow(top[-2], top[-1]);
+	return top - 1;
+}
+
+double* ExpressionParser::EvalNegate(double* top, const EvalOp&, RollEngine*)
+{
+	top[-1] = -top[-1];
+	return top;
+}
+
+double* ExpressionParser::EvalDice(double* top, const EvalOp&, RollEngine* engine)
+{
+	top[-2] = engine->RollTheBones(top[-2], top[-1]);
+	return top - 1;
+}
+
+double* ExpressionParser::EvalModifiedDice(double* top, const EvalOp& op, RollEngine* engine)
+{
+	top[-2] = engine->RollModifiedDice(top[-2], top[-1], op.modifiers);
+	return top - 1;
+}
+
+double* ExpressionParser::EvalFunction(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] = op.function(top[-1]);
+	return top;
+}
+
+double* ExpressionParser::EvalRandom(double* top, const EvalOp&, RollEngine* engine)
+{
+	top[-1] = engine->ran(top[-1]);
+	return top;
+}
+
+double* ExpressionParser::EvalAddNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] += op.value;
+	return top;
+}
+
+double* ExpressionParser::EvalSubtractNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] -= op.value;
+	return top;
+}
+
+double* ExpressionParser::EvalMultiplyNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] *= op.value;
+	return top;
+}
+
+double* ExpressionParser::EvalDivideNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] /= op.value;
+	return top;
+}
+
+double* ExpressionParser::EvalModuloNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] = ExpModulo(top[-1], op.value);
+	return top;
+}
+
+double* ExpressionParser::EvalExponentNumber(double* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] = pow(top[-1], op.value);
+	return top;
+}
+
+double* ExpressionParser::EvalDiceNumber(double* top, const EvalOp& op, RollEngine* engine)
+{
+	top[-1] = engine->RollTheBones(top[-1], op.value);
+	return top;
+}
+
+
+/* Integer evaluation handlers. Analyse() has proven every value fits, and
+ * that no modulo divides by zero. */
+int64_t* ExpressionParser::IntegerNumber(int64_t* top, const EvalOp& op, RollEngine*)
+{
+	*top = op.integer;
+	return top + 1;
 }
 
+int64_t* ExpressionParser::IntegerAdd(int64_t* top, const EvalOp&, RollEngine*)
+{
+	top[-2] += top[-1];
+	return top - 1;
+}
+
+int64_t* ExpressionParser::IntegerSubtract(int64_t* top, const EvalOp&, RollEngine*)
+{
+	top[-2] -= top[-1];
+	return top - 1;
+}
 
-void ExpressionParser::ReadToken()
+int64_t* ExpressionParser::IntegerMultiply(int64_t* top, const EvalOp&, RollEngine*)
 {
-	StackDepthCounter sdc(this);
+	top[-2] *= top[-1];
+	return top - 1;
+}
 
+int64_t* ExpressionParser::IntegerModulo(int64_t* top, const EvalOp&, RollEngine*)
+{
+	top[-2] %= top[-1];
+	return top - 1;
+}
+
+int64_t* ExpressionParser::IntegerNegate(int64_t* top, const EvalOp&, RollEngine*)
+{
+	top[-1] = -top[-1];
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerDice(int64_t* top, const EvalOp&, RollEngine* engine)
+{
+	top[-2] = (int64_t)engine->RollTheBones((double)top[-2], (double)top[-1]);
+	return top - 1;
+}
+
+int64_t* ExpressionParser::IntegerDiceWithinLimits(int64_t* top, const EvalOp&, RollEngine* engine)
+{
+	top[-2] = (int64_t)engine->RollTotal((size_t)top[-2], (unsigned int)top[-1]);
+	return top - 1;
+}
+
+int64_t* ExpressionParser::IntegerModifiedDice(int64_t* top, const EvalOp& op, RollEngine* engine)
+{
+	top[-2] = (int64_t)engine->RollModifiedDice((double)top[-2], (double)top[-1], op.modifiers);
+	return top - 1;
+}
+
+int64_t* ExpressionParser::IntegerRandom(int64_t* top, const EvalOp&, RollEngine* engine)
+{
+	top[-1] = engine->Random((unsigned int)top[-1]);
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerAddNumber(int64_t* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] += op.integer;
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerSubtractNumber(int64_t* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] -= op.integer;
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerMultiplyNumber(int64_t* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] *= op.integer;
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerModuloNumber(int64_t* top, const EvalOp& op, RollEngine*)
+{
+	top[-1] %= op.integer;
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerDiceNumber(int64_t* top, const EvalOp& op, RollEngine* engine)
+{
+	top[-1] = (int64_t)engine->RollTheBones((double)top[-1], (double)op.integer);
+	return top;
+}
+
+int64_t* ExpressionParser::IntegerDiceWithinLimitsNumber(int64_t* top, const EvalOp& op, RollEngine* engine)
+{
+	top[-1] = (int64_t)engine->RollTotal((size_t)top[-1], (unsigned int)op.integer);
+	return top;
+}
+
+
+bool ExpressionParser::ReadToken()
+{
 	/* Remember the previous token, for interpretation based on context. */
 	/* A prev_token of END indicates this is the starting token. */
 	ExpTokenType prev_token = CurrentToken.token.type;
 
+	/* Whether the previous token ended a value, so this one is expected
+	 * to be an operator. */
+	bool after_value = prev_token == NUMBER || prev_token == CPAREN || prev_token == MODIFIER;
+
+	/* Ignore unary plus, skipping to the next value. */
+	if (!after_value)
+	{
+		while (*ParsePosition == '+')
+			ParsePosition++;
+	}
+
 	/* Handle constants and functions. */
 	if (isalnum(*ParsePosition))
 	{
-		/* Build the maximum possible length text token. */
-		/* This stops at the first (. */
-		size_t TextLength = 0;
-		while ((isalnum(*ParsePosition) || *ParsePosition == '(') && TextLength < MAX_TEXT_TOKEN)
+		/* Walk the sorted table as a trie, one character at a time. After
+		 * each character, the entries from first up to last are those
+		 * whose names start with the text read so far, and if the first
+		 * of them is exactly that text, it is the longest match yet. A
+		 * function's name ends with its parenthesis, so it only matches
+		 * when its name makes up the whole of the text. */
+		size_t first = 0;
+		size_t last = TextTokenCount;
+		size_t length = 0;
+		const ExpTextToken* match = NULL;
+		size_t match_length = 0;
+		while (first < last && (isalnum(ParsePosition[length]) || ParsePosition[length] == '('))
 		{
-			TextToken[TextLength] = tolower(*ParsePosition);
-			ParsePosition++;
-			TextLength++;
-			if (TextToken[TextLength-1] == '(')
+			char c = tolower(ParsePosition[length]);
+			while (first < last && TextTokens[first].name[length] < c)
+				first++;
+			size_t end = first;
+			while (end < last && TextTokens[end].name[length] == c)
+				end++;
+			last = end;
+			length++;
+
+			if (first < last && TextTokens[first].name[length] == '\0')
+			{
+				match = &TextTokens[first];
+				match_length = length;
+			}
+			if (c == '(')
 				break;
 		}
-		TextToken[TextLength] = '\0';
 
-		/* If it ends in an (, try matching it as a function. */
-		if (TextToken[TextLength-1] == '(')
+		/* If we matched a constant or function, use it. Otherwise, carry
+		 * on and let other token types try to match it. */
+		if (match)
 		{
-			if (engine->functions.find(TextToken) != engine->functions.end())
+			/* Handle implicit multiplication. */
+			/* This must be checked AFTER we know it is a valid
+			 * constant or function, or other alphabetical operators
+			 * can break. */
+			if (after_value)
 			{
-				/* Handle implicit multiplication. */
-				/* This must be checked AFTER we know it is a
-				 * valid function, or other alphabetical
-				 * operators can break. */
-				if (prev_token == NUMBER || prev_token == CPAREN)
-				{
-					CurrentToken.token.type = MULTIPLY;
-					ParsePosition -= TextLength;
-					return;
-				}
-		
-				CurrentToken.function.type = FUNCTION;
-				CurrentToken.function.pointer = engine->functions[TextToken];
-				return;
+				CurrentToken.token.type = MULTIPLY;
+				return true;
 			}
-			
-			TextToken[TextLength-1] = '\0';
-			ParsePosition--;
-			TextLength--;
-		}
 
-		/* If that fails, try to match it as a constant, dropping
-		 * letters off until we find a match. */
-		while (TextLength > 0)
-		{
-			if (engine->constants.find(TextToken) != engine->constants.end())
+			if (match->type != NUMBER)
+			{
+				CurrentToken.function.type = match->type;
+				CurrentToken.function.pointer = match->pointer;
+			}
+			else
 			{
-				/* Handle implicit multiplication. */
-				/* This must be checked AFTER we know it is a
-				 * valid function, or other alphabetical
-				 * operators can break. */
-				if (prev_token == NUMBER || prev_token == CPAREN)
-				{
-					CurrentToken.token.type = MULTIPLY;
-					ParsePosition -= TextLength;
-					return;
-				}
-		
 				CurrentToken.number.type = NUMBER;
-				CurrentToken.number.value = engine->constants[TextToken];
-				break;
+				CurrentToken.number.value = match->value;
 			}
-			TextToken[TextLength-1] = '\0';
-			ParsePosition--;
-			TextLength--;
+			ParsePosition += match_length;
+			return true;
 		}
-
-		/* If we matched a constant or function, return. Otherwise,
-		 * carry on and let other token types try to match it. */
-		if (TextLength > 0)
-			return;
 	}
 
 	/* Handle numbers. */
 	if ((*ParsePosition >= 48 && *ParsePosition <= 57) || (*ParsePosition == '.' && *(ParsePosition+1) >= 48 && *(ParsePosition+1) <= 57))
 	{ 
 		/* Handle implicit multiplication. */
-		if (prev_token == NUMBER || prev_token == CPAREN)
+		if (after_value)
 		{
 			CurrentToken.token.type = MULTIPLY;
-			return;
+			return true;
 		}
 		
 		
@@ -342,7 +1186,7 @@ void ExpressionParser::ReadToken()
 		CurrentToken.number.type = NUMBER;
 		CurrentToken.number.value = number;
 		ParsePosition = end;
-		return;
+		return true;
 	}
 
 	/* Handle %-meaning-the-number-100 in the special context of a roll. */
@@ -351,22 +1195,15 @@ void ExpressionParser::ReadToken()
 		CurrentToken.number.type = NUMBER;
 		CurrentToken.number.value = 100;
 		ParsePosition++;
-		return;
+		return true;
 	}
 
-	/* Handle unary plus/minus. */
-	if ((prev_token != NUMBER && prev_token != CPAREN) && *ParsePosition == '+')
-	{
-		/* Ignore unary plus and skip to the next value. */
-		ParsePosition++;
-		ReadToken();
-		return;
-	}
-	if ((prev_token != NUMBER && prev_token != CPAREN) && *ParsePosition == '-')
+	/* Handle unary minus. */
+	if ((!after_value) && *ParsePosition == '-')
 	{
 		CurrentToken.token.type = UMINUS;
 		ParsePosition++;
-		return;
+		return true;
 	}
 
 	/* Handle basic operators. */
@@ -374,74 +1211,92 @@ void ExpressionParser::ReadToken()
 	{
 		CurrentToken.token.type = ADD;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == '-')
 	{
 		CurrentToken.token.type = SUBTRACT;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == '*')
 	{
 		CurrentToken.token.type = MULTIPLY;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == '/')
 	{
 		CurrentToken.token.type = DIVIDE;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == '^')
 	{
 		CurrentToken.token.type = EXPONENT;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == '%')
 	{
 		CurrentToken.token.type = MODULO;
 		ParsePosition++;
-		return;
+		return true;
+	}
+
+	/* Handle dice modifiers, which only follow values. Those made of
+	 * letters must not be followed by another letter, as "dl" could
+	 * otherwise be the start of a roll with log() sides. */
+	if (after_value)
+	{
+		bool matched;
+		if (!ReadModifier(matched))
+			return false;
+		if (matched)
+			return true;
 	}
 
 	/* Handle dice operators. */
 	if (*ParsePosition == 'd')
 	{
 		/* Handle implicit 1 in front of unnumbered dice rolls. */
-		if (prev_token != NUMBER && prev_token != CPAREN)
+		if (!after_value)
 		{
 			CurrentToken.number.type = NUMBER;
 			CurrentToken.number.value = 1;
-			return;
+			return true;
 		}
 		
-		CurrentToken.token.type = DICE;
+		CurrentToken.dice.type = DICE;
+		CurrentToken.dice.modifiers.reroll = 0;
+		CurrentToken.dice.modifiers.explode = false;
+		CurrentToken.dice.modifiers.selection = SELECT_ALL;
+		CurrentToken.dice.modifiers.select = 0;
+		CurrentToken.dice.modifiers.success = 0;
+		CurrentToken.dice.within_limits = false;
 		ParsePosition++;
-		return;
+		return true;
 	}
 
 	/* Handle parenthesis. */
 	if (*ParsePosition == '(')
 	{
 		/* Handle implicit multiplication. */
-		if (prev_token == NUMBER || prev_token == CPAREN)
+		if (after_value)
 		{
 			CurrentToken.token.type = MULTIPLY;
-			return;
+			return true;
 		}
 		
 		CurrentToken.token.type = OPAREN;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	if (*ParsePosition == ')')
 	{
 		CurrentToken.token.type = CPAREN;
 		ParsePosition++;
-		return;
+		return true;
 	}
 	
 	/* Handle end of string. */
@@ -449,16 +1304,83 @@ void ExpressionParser::ReadToken()
 	{
 		CurrentToken.token.type = END;
 		ParsePosition++;
-		return;
+		return true;
 	}
 
-	/* If nothing is matched, throw an unrecognised token error. */
+	/* If nothing is matched, it's an unrecognised token. */
 	ParsePosition++;
-	ThrowParseError("Unrecognised token in expression:");
+	return ParseError("Unrecognised token in expression:");
 }
 
 
-void ExpressionParser::ThrowParseError(const char* message)
+bool ExpressionParser::ReadModifier(bool& matched)
+{
+	ExpDiceModifiers& modifier = CurrentToken.dice.modifiers;
+	matched = true;
+	modifier.reroll = 0;
+	modifier.explode = false;
+	modifier.selection = SELECT_ALL;
+	modifier.select = 0;
+	modifier.success = 0;
+
+	/* Work out which modifier this is, and where its number starts. */
+	const char* number;
+	if (*ParsePosition == '!')
+	{
+		CurrentToken.dice.type = MODIFIER;
+		modifier.explode = true;
+		ParsePosition++;
+		return true;
+	}
+	if (ParsePosition[0] == '>' && ParsePosition[1] == '=')
+		number = ParsePosition + 2;
+	else if ((ParsePosition[0] == 'k' || ParsePosition[0] == 'd') && (ParsePosition[1] == 'h' || ParsePosition[1] == 'l') && !isalpha(ParsePosition[2]))
+	{
+		if (ParsePosition[0] == 'k')
+			modifier.selection = ParsePosition[1] == 'h' ? KEEP_HIGHEST : KEEP_LOWEST;
+		else
+			modifier.selection = ParsePosition[1] == 'h' ? DROP_HIGHEST : DROP_LOWEST;
+		number = ParsePosition + 2;
+	}
+	else if (ParsePosition[0] == 'r' && !isalpha(ParsePosition[1]))
+		number = ParsePosition + 1;
+	else
+	{
+		matched = false;
+		return true;
+	}
+
+	/* Read the number. It defaults to 1 if left out, except for success
+	 * counting, which must have one of at least 1. */
+	unsigned int value = 1;
+	bool success = *ParsePosition == '>';
+	ParsePosition = number;
+	if (isdigit(*ParsePosition))
+	{
+		value = 0;
+		for (; isdigit(*ParsePosition); ParsePosition++)
+			value = std::min(value * 10 + (*ParsePosition - '0'), 100000000U);
+	}
+	else if (success)
+	{
+		ParsePosition++;
+		return ParseError("Missing number for dice success counting:");
+	}
+	if (success && !value)
+		return ParseError("Dice success counting needs a number of at least 1:");
+
+	CurrentToken.dice.type = MODIFIER;
+	if (success)
+		modifier.success = value;
+	else if (modifier.selection)
+		modifier.select = value;
+	else
+		modifier.reroll = value;
+	return true;
+}
+
+
+bool ExpressionParser::ParseError(const char* message)
 {
 	engine->results->Clear();
 	engine->results->AddError("Error parsing expression.");
@@ -474,6 +1396,5 @@ void ExpressionParser::ThrowParseError(const char* message)
 		error_marker += '-';
 	error_marker += '^';
 	engine->results->AddError(error_marker);
-
-	throw new RollException;
+	return false;
 }
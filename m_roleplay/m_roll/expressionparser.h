@@ -5,8 +5,11 @@
 /* The defined limits used in parsing expressions. */
 #define MAX_EXP_TOKENS 1000   /* Maximum tokens in one expression. */
 #define MAX_NUM_STACK 1000    /* Maximum numbers at once in evaluation. */
-#define MAX_STACK_DEPTH 10000 /* Maximum recursion depth. */
-#define MAX_TEXT_TOKEN 32     /* Maximum length of a textual token. */
+#define MAX_OPERATOR_STACK 1000 /* Maximum operators waiting in parsing. */
+#define EVAL_LANES 64         /* Trials evaluated at once by EvalBatch(). */
+#define MAX_EXP_COST 100000   /* Maximum worst case dice and steps in one evaluation. */
+#define MAX_DICE_EXPLOSIONS 100 /* Maximum times one exploding die rolls again. */
+#define MAX_EXACT_INTEGER 9007199254740992.0 /* 2^53; every whole number up to this is exact as a double. */
 
 
 /* Declare expression token classes. Each token is one of these classes. */
@@ -30,10 +33,15 @@ class ExpressionParser;
  * DICE: A dice operator ("d")
  * NUMBER: A number, or a constant converted to a number in parsing.
  * FUNCTION: A function, taking a single double and returning a single double.
+ * RANDOM: The ran() function, which rolls a die with the given sides. This is
+ *         kept apart from FUNCTION as the only function with random results.
  * OPAREN: Opening parenthesis; used during parsing, should never be added to
  *         the parsed expression.
  * CPAREN: Closing parenthesis; used during parsing, should never be added to
  *         the parsed expression.
+ * MODIFIER: A dice roll modifier ("kh3", "r1", "!", ">=8", ...); merged into
+ *           the dice operator before it during parsing, should never be
+ *           added to the parsed expression.
  * END: End of the expression; indicates the expression string has ended.
  *      Should never be added to the parsed expression. */
 enum ExpTokenType
@@ -43,7 +51,7 @@ enum ExpTokenType
 	EXPONENT,
 	UMINUS,
 	DICE,
-	NUMBER, FUNCTION, OPAREN, CPAREN,
+	NUMBER, FUNCTION, RANDOM, OPAREN, CPAREN, MODIFIER,
 	END
 };
 
@@ -54,8 +62,48 @@ enum ExpTokenType
  * of time. */
 class ExpTokenSimple { public: ExpTokenType type; };
 class ExpTokenNumber { public: ExpTokenType type; double value; };
-typedef double(RollEngine::*RollEngineMathFunc)(double);
-class ExpTokenFunction { public: ExpTokenType type; RollEngineMathFunc pointer; };
+typedef double(*ExpMathFunc)(double);
+class ExpTokenFunction { public: ExpTokenType type; ExpMathFunc pointer; };
+
+
+
+/* Dice roll modifiers. These change how the dice of a roll are rolled and
+ * totalled, applied in the order of their fields; a zero field changes
+ * nothing. Each may be given only once for a roll.
+ * reroll: Faces up to this are rerolled until they are higher ("r<N>").
+ * explode: Dice on their highest face roll again and add the roll, up to
+ *          MAX_DICE_EXPLOSIONS times ("!").
+ * selection, select: Only some of the dice are kept, by keeping or dropping
+ *                    select of the highest or lowest ("kh<N>", "kl<N>",
+ *                    "dh<N>", "dl<N>"); only one of these may be given.
+ * success: The result is the number of kept dice reaching this, rather than
+ *          their total (">=<N>"). */
+enum ExpDiceSelection
+{
+	SELECT_ALL, KEEP_HIGHEST, KEEP_LOWEST, DROP_HIGHEST, DROP_LOWEST
+};
+class ExpDiceModifiers
+{
+ public:
+	unsigned int reroll;
+	bool explode;
+	ExpDiceSelection selection;
+	unsigned int select;
+	unsigned int success;
+
+	bool Any() const { return reroll || explode || selection || success; }
+};
+class ExpTokenDice
+{
+ public:
+	ExpTokenType type;
+	ExpDiceModifiers modifiers;
+
+	/* Set by Analyse() when the count and sides are always within the
+	 * limits of CheckDice(), so need no checking in whole number
+	 * expressions. */
+	bool within_limits;
+};
 
 
 
@@ -65,10 +113,91 @@ union ExpToken {
 	ExpTokenSimple token;
 	ExpTokenNumber number;
 	ExpTokenFunction function;
+	ExpTokenDice dice;
+};
+
+
+/* Text token. Constants and functions are looked up in a static table of
+ * these, sorted by name. A function's name includes its opening parenthesis,
+ * and its pointer is set, except for ran(); a constant's pointer is NULL. */
+class ExpTextToken
+{
+ public:
+	const char* name;
+	ExpTokenType type;
+	double value;
+	ExpMathFunc pointer;
+};
+
+
+
+/* The lowest and highest a value in an expression could be. Values which
+ * could be anything, including not a number, are from -infinity to
+ * infinity. */
+class ExpBounds
+{
+ public:
+	double low;
+	double high;
+
+	ExpBounds() { }
+	ExpBounds(double l, double h) : low(l), high(h)
+	{
+		if (low != low || high != high)
+			Unbound();
+	}
+
+	void Unbound()
+	{
+		low = -std::numeric_limits<double>::infinity();
+		high = std::numeric_limits<double>::infinity();
+	}
+
+	/* The highest the magnitude of the value could be. */
+	double Magnitude() const { return std::max(-low, high); }
+};
+
+
+
+/* The remainder of dividing the whole part of a by that of b, as the %
+ * operator gives; dividing by zero gives NaN, and a zero remainder is always
+ * positive zero. */
+inline double ExpModulo(double a, double b)
+{
+	return ::fmod(::trunc(a), ::trunc(b)) + 0.0;
+}
+
+
+
+/* Compiled expression operation. Parsed expressions are compiled into an
+ * array of these for evaluation, each holding the handler that performs it,
+ * and its operand, if any. A number used straight away by a binary operator
+ * is inlined into the operator as its right-hand operand. Each handler takes
+ * the top of the evaluation stack, one past the last value, and returns the
+ * new top. Whole number expressions are compiled to integer handlers, with an
+ * int64_t stack. */
+class EvalOp;
+typedef double* (*EvalHandler)(double* top, const EvalOp& op, RollEngine* engine);
+typedef int64_t* (*IntegerEvalHandler)(int64_t* top, const EvalOp& op, RollEngine* engine);
+class EvalOp
+{
+ public:
+	union
+	{
+		EvalHandler handler;
+		IntegerEvalHandler integer_handler;
+	};
+	union
+	{
+		double value;               /* Numbers, and inlined right-hand operands. */
+		int64_t integer;            /* The same, for integer handlers. */
+		ExpMathFunc function;       /* Functions. */
+		ExpDiceModifiers modifiers; /* Dice rolls with modifiers. */
+	};
 };
 
 
-/* Text token comparison functor, used for the text token maps. */
+/* C string comparison functor, used for the expression cache index. */
 class TextTokenCompare : public std::binary_function<char const *, char const *, bool>
 {
  public:
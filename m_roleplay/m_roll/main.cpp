@@ -16,6 +16,9 @@
  */
 
 #include <queue>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "inspircd.h"
 #include "modules.h"
@@ -29,9 +32,15 @@
  * scores over IRC.
  */
 
+/* The limits used in splitting simulations between worker threads. */
+#define MAX_SIM_WORKERS 16          /* Maximum worker threads per simulation. */
+#define MIN_SIM_WORKER_TRIALS 10000 /* Minimum trials worth a worker thread. */
+
 class ModuleRoll;
 class RollThread;
+class SimulationWorker;
 class UserRoll;
+class RenderedLine;
 class UserRollResults;
 
 class RollRestrict;
@@ -56,6 +65,22 @@ class UserRoll : public Roll
 
 
 
+/* The recipients of a rendered line; the channel rolled to, the user who
+ * requested the roll, or the user rolled to. */
+enum RenderRecipient { RENDER_CHANNEL, RENDER_SOURCE, RENDER_TARGET };
+
+/* RenderedLine class. */
+/* A line of results as it is sent to a local recipient, from the source
+ * prefix to the end of the text. */
+class RenderedLine
+{
+ public:
+	RenderRecipient recipient;
+	std::string line;
+};
+
+
+
 /* UserRollResults class. */
 /* A roll result with associated information on the requesting user and the
  * target. */
@@ -68,6 +93,29 @@ class UserRollResults : public RollResults
 	/* The target of the roll; either - for none but the requester, a UUID
 	 * for a user, or a channel name for a channel. */
 	std::string target;
+
+	/* The results rendered into the lines DisplayResults() would send, by
+	 * the roll thread, so the main thread need only write them out. They
+	 * are rendered for the output type and the nicks of the requester and
+	 * the user rolled to at the time of the roll, and may only be used
+	 * while those still match; see RenderedFor(). */
+	std::vector<RenderedLine> rendered;
+	RollOutputType renderedtype;
+	std::string renderednick;
+	std::string renderedtargetnick;
+
+	/* Render the results of the given roll. */
+	/* Run by roll thread. */
+	void Render(const UserRoll& roll);
+
+	/* Whether the rendered lines are still right for the given recipients. */
+	/* Run by main thread. */
+	bool RenderedFor(User* user, User* targetuser, Channel* targetchan) const;
+
+ private:
+	/* Add a rendered line of the form ":<source> <command> <target>
+	 * :<before><text><after>". */
+	void AddRendered(RenderRecipient recipient, const std::string& linesource, const char* command, const std::string& linetarget, const char* before, const char* text, const char* after);
 };
 
 
@@ -87,9 +135,28 @@ class ModuleRoll : public Module
 	/* Only one or neither of targetuser or targetchan may be non-NULL. */
 	void DisplayResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results);
 
+	/* Function called to display a set of results locally from the lines
+	 * the roll thread rendered for them. */
+	void WriteRendered(User *user, User *targetuser, Channel *targetchan, const std::vector<RenderedLine>& rendered);
+
  public:
 	
 	RollThread *Roller;
+
+	/* Simulations are run on a thread of their own, so long ones never
+	 * hold up ordinary rolls. */
+	RollThread *Simulator;
+
+	/* Checks rolls on the main thread before they are queued, so malformed
+	 * expressions are answered straight away. Only the main thread may use
+	 * it, and it never rolls anything. */
+	RollEngine Validator;
+
+	/* The sequence number to give the next roll. Each roll's random
+	 * numbers come from its own stream, picked by its sequence number and
+	 * the key derived from the <roll secret> setting, so any logged roll
+	 * can be replayed exactly given the secret. */
+	uint64_t RollSequence;
 	
 	ModuleRoll();
 	~ModuleRoll();
@@ -100,8 +167,9 @@ class ModuleRoll : public Module
 	virtual char* OnSaveState();
 	virtual void OnRestoreState(const char* state);
 
-	/* Send the results of a roll, locally and remotely. */
-	void SendResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results);
+	/* Send the results of a roll, locally and remotely. If rendered lines
+	 * are given, they are written out locally in place of the results. */
+	void SendResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results, const std::vector<RenderedLine>* rendered = NULL);
 
 	/* Handle a remotely-received roll. */
 	void RemoteResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results);
@@ -124,7 +192,7 @@ class RollThread : public SocketThread
 	InspIRCd* ServerInstance;
 	ModuleRoll* ModuleInstance;
 
-	RollThread(InspIRCd* Instance, ModuleRoll* Me) : SocketThread(), ServerInstance(Instance), ModuleInstance(Me) { }	
+	RollThread(InspIRCd* Instance, ModuleRoll* Me, uint64_t key, size_t cachesize);
 	bool AddRoll(UserRoll* roll);
 	UserRollResults* GetRollResults();
 	virtual void OnNotify();
@@ -134,8 +202,9 @@ class RollThread : public SocketThread
 	/* The main thread creates a UserRoll instance, and adds it to the
 	 * incoming queue, after which it must not access the instance. The roll
 	 * thread runs the roll, then deletes it.
-	 * The roll thread then creates a UserRollResults instance, and adds it
-	 * to the outgoing queue, after which it must not access the instance.
+	 * The roll thread then creates a UserRollResults instance, renders the
+	 * lines to send for it, and adds it to the outgoing queue, after which
+	 * it must not access the instance.
 	 * The main thread handles the results, then deletes them.
 	 * In case of shutdown, the main thread must not access either queue
 	 * after setting the exit flag of the roll thread. The roll thread will
@@ -146,7 +215,48 @@ class RollThread : public SocketThread
 
 	RollEngine RE;
 
+	/* The key for the generators of this thread's engine and simulation
+	 * workers. */
+	uint64_t Key;
+
+	/* The expression cache capacity of this thread's engine and
+	 * simulation workers. */
+	size_t CacheSize;
+
 	virtual void Run();
+
+	/* Run a SIM roll, splitting its trials between worker threads. */
+	void RunSimulation(UserRoll* roll, UserRollResults* results);
+};
+
+
+
+/* Simulation Worker Class */
+/* Runs a share of the trials of a simulation on an engine of its own. The
+ * RollThread running the simulation creates and starts the workers, and must
+ * not access them again until each has been joined. */
+class SimulationWorker : public Thread
+{
+ public:
+	/* The tally of this worker's trials; read once it has been joined. */
+	SimulationTally tally;
+
+	/* The worker takes ownership of the passed generator. */
+	SimulationWorker(const Roll& Trial, unsigned long Trials, RandomGenerator* Stream, size_t CacheSize) : Thread(), trial(Trial), trials(Trials)
+	{
+		RE.SetGenerator(Stream);
+		RE.SetExpressionCacheCapacity(CacheSize);
+	}
+
+	virtual void Run()
+	{
+		RE.Simulate(trial, trials, tally);
+	}
+
+ private:
+	const Roll& trial;
+	unsigned long trials;
+	RollEngine RE;
 };
 
 
@@ -261,7 +371,7 @@ class CommandRoll : public Command
 	CommandRoll (ModuleRoll* Me) : Command(Me, "ROLL", 1)
 	{
 		this->ModuleInstance = Me;
-		syntax = "[target] <expression|preset roll> [preset roll parameters] [optional text]";
+		syntax = "[target] [ODDS|SIM <trials>] <expression|preset roll> [preset roll parameters] [optional text]";
 		TRANSLATE3(TR_NICK, TR_TEXT, TR_END);
 	}
 
@@ -305,9 +415,26 @@ class CommandRoll : public Command
 			return CMD_FAILURE;
 		}
 
+		/* ROLL ODDS calculates the odds of the expression which follows,
+		 * rather than rolling it. */
+		RollType type = ROLL;
+		if ((size_t)rollstart + 1 < params.size() && !strcasecmp(params[rollstart].c_str(), "odds"))
+		{
+			type = ODDS;
+			rollstart++;
+		}
+
+		/* ROLL SIM runs the roll which follows the given number of
+		 * times, and summarises the outcomes. */
+		else if ((size_t)rollstart + 2 < params.size() && !strcasecmp(params[rollstart].c_str(), "sim"))
+		{
+			type = SIM;
+			rollstart++;
+		}
+
 		/* Create roll. */
 		UserRoll *roll = new UserRoll;
-		roll->type = ROLL;
+		roll->type = type;
 
 		/* Set the roll expression. */
 		for (size_t i = rollstart; i < params.size(); i++)
@@ -334,8 +461,20 @@ class CommandRoll : public Command
 			roll->target = "-";
 		}
 
+		/* Reject expressions which won't parse without queueing them;
+		 * the errors are sent just as the rolling thread would have. */
+		RollResults errors;
+		if (!ModuleInstance->Validator.Validate(*roll, errors))
+		{
+			delete roll;
+			ModuleInstance->SendResults(user, targetuser, targetchan, errors);
+			return CMD_FAILURE;
+		}
+		roll->sequence = ModuleInstance->RollSequence++;
+
 		/* Add roll to queue. */
-		bool added = ModuleInstance->Roller->AddRoll(roll);
+		RollThread* thread = (type == SIM ? ModuleInstance->Simulator : ModuleInstance->Roller);
+		bool added = thread->AddRoll(roll);
 		if (!added)
 		{
 			std::string errsource = "=Roll=!" + user->nick + "@" + "roll.fakeuser.invalid";
@@ -397,6 +536,7 @@ class CommandScores : public Command
 		/* Create roll. */
 		UserRoll *roll = new UserRoll;
 		roll->type = SCORES;
+		roll->sequence = ModuleInstance->RollSequence++;
 
 		/* Set the roll expression. */
 		for (size_t i = 1; i < parameters.size(); i++)
@@ -504,8 +644,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG STARTEND has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(MESSAGE);
-				results.data.push_back(parameters[5]);
+				results.AddMsg(parameters[5]);
 			}
 			else if (parameters[4] == "A")
 			{
@@ -514,8 +653,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG STARTEND has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(ACTION);
-				results.data.push_back(parameters[5]);
+				results.AddAction(parameters[5]);
 			}
 			else if (parameters[4] == "N")
 			{
@@ -524,9 +662,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG STARTEND has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(NPC);
-				results.data.push_back(parameters[5]);
-				results.data.push_back(parameters[6]);
+				results.AddNPC(parameters[5], parameters[6]);
 			}
 			else if (parameters[4] == "NA")
 			{
@@ -535,9 +671,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG STARTEND has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(NPCA);
-				results.data.push_back(parameters[5]);
-				results.data.push_back(parameters[6]);
+				results.AddNPCA(parameters[5], parameters[6]);
 			}
 			else if (parameters[4] == "S")
 			{
@@ -546,8 +680,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG STARTEND has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(SCENE);
-				results.data.push_back(parameters[5]);
+				results.AddScene(parameters[5]);
 			}
 			else
 			{
@@ -583,8 +716,7 @@ public:
 					return CMD_FAILURE;
 
 				}
-				results.types.push_back(MESSAGE);
-				results.data.push_back(parameters[3]);
+				results.AddMsg(parameters[3]);
 			}
 			else if (parameters[2] == "A")
 			{
@@ -593,8 +725,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG START has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(ACTION);
-				results.data.push_back(parameters[3]);
+				results.AddAction(parameters[3]);
 			}
 			else if (parameters[2] == "N")
 			{
@@ -603,9 +734,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG START has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(NPC);
-				results.data.push_back(parameters[3]);
-				results.data.push_back(parameters[4]);
+				results.AddNPC(parameters[3], parameters[4]);
 			}
 			else if (parameters[2] == "NA")
 			{
@@ -614,9 +743,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG START has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(NPCA);
-				results.data.push_back(parameters[3]);
-				results.data.push_back(parameters[4]);
+				results.AddNPCA(parameters[3], parameters[4]);
 			}
 			else if (parameters[2] == "S")
 			{
@@ -625,8 +752,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG START has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results.types.push_back(SCENE);
-				results.data.push_back(parameters[3]);
+				results.AddScene(parameters[3]);
 			}
 			else
 			{
@@ -659,8 +785,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG MIDDLE has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(MESSAGE);
-				results->second.data.push_back(parameters[3]);
+				results->second.AddMsg(parameters[3]);
 			}
 			else if (parameters[2] == "A")
 			{
@@ -669,8 +794,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG MIDDLE has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(ACTION);
-				results->second.data.push_back(parameters[3]);
+				results->second.AddAction(parameters[3]);
 			}
 			else if (parameters[2] == "N")
 			{
@@ -679,9 +803,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG MIDDLE has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(NPC);
-				results->second.data.push_back(parameters[3]);
-				results->second.data.push_back(parameters[4]);
+				results->second.AddNPC(parameters[3], parameters[4]);
 			}
 			else if (parameters[2] == "NA")
 			{
@@ -690,9 +812,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG MIDDLE has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(NPCA);
-				results->second.data.push_back(parameters[3]);
-				results->second.data.push_back(parameters[4]);
+				results->second.AddNPCA(parameters[3], parameters[4]);
 			}
 			else if (parameters[2] == "S")
 			{
@@ -701,8 +821,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG MIDDLE has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(SCENE);
-				results->second.data.push_back(parameters[3]);
+				results->second.AddScene(parameters[3]);
 			}
 			else
 			{
@@ -755,8 +874,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG END has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(MESSAGE);
-				results->second.data.push_back(parameters[5]);
+				results->second.AddMsg(parameters[5]);
 			}
 			else if (parameters[4] == "A")
 			{
@@ -765,8 +883,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG END has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(ACTION);
-				results->second.data.push_back(parameters[5]);
+				results->second.AddAction(parameters[5]);
 			}
 			else if (parameters[4] == "N")
 			{
@@ -775,9 +892,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG END has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(NPC);
-				results->second.data.push_back(parameters[5]);
-				results->second.data.push_back(parameters[6]);
+				results->second.AddNPC(parameters[5], parameters[6]);
 			}
 			else if (parameters[4] == "NA")
 			{
@@ -786,9 +901,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG END has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(NPCA);
-				results->second.data.push_back(parameters[5]);
-				results->second.data.push_back(parameters[6]);
+				results->second.AddNPCA(parameters[5], parameters[6]);
 			}
 			else if (parameters[4] == "S")
 			{
@@ -797,8 +910,7 @@ public:
 					ServerInstance->Logs->Log("m_roll", DEBUG, "ROLLMSG END has the wrong number of parameters and is malformed; ignoring it.");
 					return CMD_FAILURE;
 				}
-				results->second.types.push_back(SCENE);
-				results->second.data.push_back(parameters[5]);
+				results->second.AddScene(parameters[5]);
 			}
 			else
 			{
@@ -830,8 +942,30 @@ public:
 
 ModuleRoll::ModuleRoll() : Module()
 {
-	Roller = new RollThread(ServerInstance, this);
+	/* Derive the generator key from the configured secret, or a random
+	 * one if none is set, in which case rolls cannot be replayed after
+	 * the module is reloaded. */
+	ConfigTag* tag = ServerInstance->Config->ConfValue("roll");
+	std::string secret = tag->getString("secret");
+	if (secret.empty())
+	{
+		char random[32];
+		ServerInstance->GenRandom(random, sizeof(random));
+		secret.assign(random, sizeof(random));
+	}
+	uint64_t key = PhiloxGenerator::KeyFromSecret(secret);
+
+	/* Sequence numbers start from the time, so they are not reused with
+	 * the same secret after a restart. */
+	RollSequence = (uint64_t)time(NULL) << 24;
+
+	/* Each engine keeps this many recently rolled expressions compiled. */
+	size_t cachesize = std::max(tag->getInt("cachesize", EXPRESSION_CACHE_SIZE), 0L);
+
+	Roller = new RollThread(ServerInstance, this, key, cachesize);
 	ServerInstance->Threads->Start(Roller);
+	Simulator = new RollThread(ServerInstance, this, key, cachesize);
+	ServerInstance->Threads->Start(Simulator);
 
 	rollcommand = new CommandRoll(this);
 	ServerInstance->AddCommand(rollcommand);
@@ -857,6 +991,7 @@ ModuleRoll::~ModuleRoll()
 	delete(rollmsgCommand);
 
 	Roller->state->FreeThread(Roller);
+	Simulator->state->FreeThread(Simulator);
 	ServerInstance->Modes->DelMode(rr);
 	delete rr;
 }
@@ -977,10 +1112,13 @@ void ModuleRoll::OnRestoreState(const char* state)
 
 
 
-void ModuleRoll::SendResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results)
+void ModuleRoll::SendResults(User *user, User *targetuser, Channel *targetchan, const RollResults& results, const std::vector<RenderedLine>* rendered)
 {	
 	/* Display results locally. Will not execute kicks/shuns. */
-	DisplayResults(user, targetuser, targetchan, results);
+	if (rendered)
+		WriteRendered(user, targetuser, targetchan, *rendered);
+	else
+		DisplayResults(user, targetuser, targetchan, results);
 
 	/* Determine the target servers and target string for propagation. */
 	std::string targetservers;
@@ -1001,50 +1139,39 @@ void ModuleRoll::SendResults(User *user, User *targetuser, Channel *targetchan,
 	{
 		/* Build a list of roll messages to be sent. */
 		std::list<parameterlist> sendlines;
-		std::list<std::string>::const_iterator line = results.data.begin();
-		for (std::list<RollResultType>::const_iterator i = results.types.begin(); i != results.types.end(); i++)
+		for (std::vector<RollResultLine>::const_iterator line = results.lines.begin(); line != results.lines.end(); ++line)
 		{
 			parameterlist sendparams;
 
 			/* Ignore non-propagating types... */
-			if (*i == ERR || *i == KICK)
-			{
-				/* Skip one line. */
-				line++;
-				continue;
-			}
-			else if (*i == SHUN)
-			{
-				/* Skip two lines. */
-				line++; line++;
+			if (line->type == ERR || line->type == KICK || line->type == SHUN)
 				continue;
-			}
 
 			/* Handle propagation. */
-			if (*i == MESSAGE)
+			if (line->type == MESSAGE)
 			{
 				sendparams.push_back("M");
 			}
-			else if (*i == ACTION)
+			else if (line->type == ACTION)
 			{
 				sendparams.push_back("A");
 			}
-			else if (*i == NPC)
+			else if (line->type == NPC)
 			{
 				sendparams.push_back("N");
-				sendparams.push_back(*(line++));
+				sendparams.push_back(results.Extra(*line));
 			}
-			else if (*i == NPCA)
+			else if (line->type == NPCA)
 			{
 				sendparams.push_back("NA");
-				sendparams.push_back(*(line++));
+				sendparams.push_back(results.Extra(*line));
 			}
-			else if (*i == SCENE)
+			else if (line->type == SCENE)
 			{
 				sendparams.push_back("S");
 			}
 
-			sendparams.push_back(":" + *(line++));
+			sendparams.push_back(std::string(":") + results.Text(*line));
 			sendlines.push_back(sendparams);
 		}
 		
@@ -1098,38 +1225,27 @@ void ModuleRoll::SendResults(User *user, User *targetuser, Channel *targetchan,
 	/* Process and propagate kicks and shuns. These always occur AFTER
 	 * all other messages, and are special in that the IRCD handles their
 	 * routing. */
-	std::list<std::string>::const_iterator line = results.data.begin();
-	for (std::list<RollResultType>::const_iterator i = results.types.begin(); i != results.types.end(); i++)
+	for (std::vector<RollResultLine>::const_iterator line = results.lines.begin(); line != results.lines.end(); ++line)
 	{
 		/* Ignore types displayed/propagated normally... */
-		if (*i == ERR || *i == MESSAGE || *i == ACTION || *i == SCENE)
-		{
-			/* Skip one line. */
-			line++;
+		if (line->type != KICK && line->type != SHUN)
 			continue;
-		}
-		else if (*i == NPC || *i == NPCA)
-		{
-			/* Skip two lines. */
-			line++; line++;
-			continue;
-		}
 
-		if (*i == KICK)
+		if (line->type == KICK)
 		{
 			/* We know the user is always local. */
 			if (targetchan)
 			{
-				targetchan->KickUser(ServerInstance->FakeClient, user, (*line++).c_str());
+				targetchan->KickUser(ServerInstance->FakeClient, user, results.Text(*line));
 			}
 		}
 
-		else if (*i == SHUN)
+		else if (line->type == SHUN)
 		{
 			XLineFactory* ShunFactory = ServerInstance->XLines->GetFactory("SHUN");
 			std::string mask = user->nick + "!" + user->ident + "@" + user->host;
-			std::string reason = *line++;
-			long duration = atol((*line++).c_str());
+			std::string reason = results.Text(*line);
+			long duration = atol(results.Extra(*line));
 
 			if (!ShunFactory)
 			{
@@ -1165,97 +1281,211 @@ void ModuleRoll::DisplayResults(User* user, User *targetuser, Channel* targetcha
 {
 	/* Go over each result, and send it to the its targets on this
 	 * server. */
-	std::list<std::string>::const_iterator line = results.data.begin();
-	for (std::list<RollResultType>::const_iterator i = results.types.begin(); i != results.types.end(); i++)
+	for (std::vector<RollResultLine>::const_iterator line = results.lines.begin(); line != results.lines.end(); ++line)
 	{
-		/* Ignore results not displayed here... */
-		if (*i == KICK)
-		{
-			/* Skip one line. */
-			line++;
-		}
-		else if (*i == SHUN)
-		{
-			/* Skip two lines. */
-			line++; line++;
-		}
+		/* Kicks and shuns are not displayed here, and match none of
+		 * these. */
+		const char* text = results.Text(*line);
 
-		if (*i == ERR)
+		if (line->type == ERR)
 		{
 			std::string source = "=Roll=!" + user->nick + "@" + "roll.fakeuser.invalid";
-			user->Write(":%s NOTICE %s :%s", source.c_str(), user->nick.c_str(), line->c_str());
-			++line;
+			user->Write(":%s NOTICE %s :%s", source.c_str(), user->nick.c_str(), text);
 		}
 
-		else if (*i == MESSAGE)
+		else if (line->type == MESSAGE)
 		{
 			std::string source = "=Roll=!" + user->nick + "@" + "roll.fakeuser.invalid";
 			if (targetchan)
 			{
-				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), line->c_str());
+				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), text);
 			}
 			else
-				user->Write(":%s NOTICE %s :%s", source.c_str(), user->nick.c_str(), line->c_str());
+				user->Write(":%s NOTICE %s :%s", source.c_str(), user->nick.c_str(), text);
 			
 			if (targetuser)
-				targetuser->Write(":%s NOTICE %s :%s", source.c_str(), targetuser->nick.c_str(), line->c_str());
-
-			++line;
+				targetuser->Write(":%s NOTICE %s :%s", source.c_str(), targetuser->nick.c_str(), text);
 		}
 		
-		else if (*i == ACTION)
+		else if (line->type == ACTION)
 		{
 			std::string source = "=Roll=!" + user->nick + "@" + "roll.fakeuser.invalid";
 			if (targetchan)
 			{
-				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :\1ACTION %s.\1", targetchan->name.c_str(), line->c_str());
+				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :\1ACTION %s.\1", targetchan->name.c_str(), text);
 			}
 			else
-				user->Write(":%s NOTICE %s :*%s*", source.c_str(), user->nick.c_str(), line->c_str());
+				user->Write(":%s NOTICE %s :*%s*", source.c_str(), user->nick.c_str(), text);
 	
 			if (targetuser)
-				targetuser->Write(":%s NOTICE %s :*%s*", source.c_str(), targetuser->nick.c_str(), line->c_str());
-
-			++line;
+				targetuser->Write(":%s NOTICE %s :*%s*", source.c_str(), targetuser->nick.c_str(), text);
 		}
 
-		else if (*i == NPC)
+		else if (line->type == NPC)
 		{
-			std::string source = "\x1F" + (*line++) + "\xF!" + user->nick + "@" + "roll.fakeuser.invalid";
+			std::string source = "\x1F" + std::string(results.Extra(*line)) + "\xF!" + user->nick + "@" + "roll.fakeuser.invalid";
 			if (targetchan)
 			{
-				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), line->c_str());
+				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), text);
 			}
-
-			++line;
 		}
 
-		else if (*i == NPCA)
+		else if (line->type == NPCA)
 		{
-			std::string source = "\x1F" + (*line++) + "\x1F!" + user->nick + "@" + "roll.fakeuser.invalid";
+			std::string source = "\x1F" + std::string(results.Extra(*line)) + "\x1F!" + user->nick + "@" + "roll.fakeuser.invalid";
 			if (targetchan)
 			{
-				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :\1ACTION %s.\1", targetchan->name.c_str(), line->c_str());
+				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :\1ACTION %s.\1", targetchan->name.c_str(), text);
 			}
-
-			++line;
 		}
 		
-		else if (*i == SCENE)
+		else if (line->type == SCENE)
 		{
 			std::string source = "=Scene=!" + user->nick + "@" + "roll.fakeuser.invalid";
 			if (targetchan)
 			{
-				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), line->c_str());
+				targetchan->WriteChannelWithServ(source.c_str(), "PRIVMSG %s :%s", targetchan->name.c_str(), text);
 			}
+		}
+	}
+}
 
-			++line;
+
+void ModuleRoll::WriteRendered(User *user, User *targetuser, Channel *targetchan, const std::vector<RenderedLine>& rendered)
+{
+	/* The lines are complete; just send each to its recipients on this
+	 * server. */
+	CUList except;
+	for (std::vector<RenderedLine>::const_iterator i = rendered.begin(); i != rendered.end(); i++)
+	{
+		if (i->recipient == RENDER_CHANNEL)
+			targetchan->RawWriteAllExcept(user, false, 0, except, i->line);
+		else if (i->recipient == RENDER_SOURCE)
+			user->Write(i->line);
+		else
+			targetuser->Write(i->line);
+	}
+}
+
+
+
+/* Render results into the lines DisplayResults() would send for them, for the
+ * nicks and target given to the roll. */
+/* Run by roll thread. */
+void UserRollResults::Render(const UserRoll& roll)
+{
+	renderedtype = roll.outputtype;
+	renderednick = roll.extra[0];
+	renderedtargetnick = roll.outputtype == IRC_PM ? roll.extra[1] : "";
+	rendered.reserve(lines.size() * (roll.outputtype == IRC_PM ? 2 : 1));
+
+	std::string rollsource = "=Roll=!" + renderednick + "@roll.fakeuser.invalid";
+	std::string npcsuffix = "!" + renderednick + "@roll.fakeuser.invalid";
+	for (std::vector<RollResultLine>::const_iterator line = lines.begin(); line != lines.end(); ++line)
+	{
+		const char* text = Text(*line);
+		if (line->type == ERR)
+		{
+			AddRendered(RENDER_SOURCE, rollsource, "NOTICE", renderednick, "", text, "");
+		}
+
+		else if (line->type == MESSAGE)
+		{
+			if (renderedtype == IRC_CHAN)
+				AddRendered(RENDER_CHANNEL, rollsource, "PRIVMSG", roll.target, "", text, "");
+			else
+				AddRendered(RENDER_SOURCE, rollsource, "NOTICE", renderednick, "", text, "");
+
+			if (renderedtype == IRC_PM)
+				AddRendered(RENDER_TARGET, rollsource, "NOTICE", renderedtargetnick, "", text, "");
+		}
+
+		else if (line->type == ACTION)
+		{
+			if (renderedtype == IRC_CHAN)
+				AddRendered(RENDER_CHANNEL, rollsource, "PRIVMSG", roll.target, "\1ACTION ", text, ".\1");
+			else
+				AddRendered(RENDER_SOURCE, rollsource, "NOTICE", renderednick, "*", text, "*");
+
+			if (renderedtype == IRC_PM)
+				AddRendered(RENDER_TARGET, rollsource, "NOTICE", renderedtargetnick, "*", text, "*");
+		}
+
+		/* NPC lines, NPC actions and scenes are only seen in channels. */
+		else if (renderedtype != IRC_CHAN)
+			continue;
+
+		else if (line->type == NPC)
+		{
+			std::string source = "\x1F" + std::string(Extra(*line)) + "\xF" + npcsuffix;
+			AddRendered(RENDER_CHANNEL, source, "PRIVMSG", roll.target, "", text, "");
+		}
+
+		else if (line->type == NPCA)
+		{
+			std::string source = "\x1F" + std::string(Extra(*line)) + "\x1F" + npcsuffix;
+			AddRendered(RENDER_CHANNEL, source, "PRIVMSG", roll.target, "\1ACTION ", text, ".\1");
+		}
+
+		else if (line->type == SCENE)
+		{
+			AddRendered(RENDER_CHANNEL, "=Scene=" + npcsuffix, "PRIVMSG", roll.target, "", text, "");
 		}
 	}
 }
 
 
 
+/* Run by roll thread. */
+void UserRollResults::AddRendered(RenderRecipient recipient, const std::string& linesource, const char* command, const std::string& linetarget, const char* before, const char* text, const char* after)
+{
+	rendered.push_back(RenderedLine());
+	RenderedLine& rendering = rendered.back();
+	rendering.recipient = recipient;
+
+	std::string& line = rendering.line;
+	line.reserve(linesource.size() + linetarget.size() + strlen(command) + strlen(before) + strlen(text) + strlen(after) + 5);
+	line += ":";
+	line += linesource;
+	line += " ";
+	line += command;
+	line += " ";
+	line += linetarget;
+	line += " :";
+	line += before;
+	line += text;
+	line += after;
+}
+
+
+
+/* The rendered lines are for the requester's nick and the target the results
+ * are being sent to; they can't be used if either nick has changed since. */
+/* Run by main thread. */
+bool UserRollResults::RenderedFor(User* user, User* targetuser, Channel* targetchan) const
+{
+	if (user->nick != renderednick)
+		return false;
+	if (targetchan)
+		return renderedtype == IRC_CHAN;
+	if (targetuser)
+		return renderedtype == IRC_PM && targetuser->nick == renderedtargetnick;
+	return renderedtype == IRC_SELF;
+}
+
+
+
+/* Set up the roll thread, giving its engine a generator with the key, and
+ * its expression cache the capacity. */
+/* Run by main thread. */
+RollThread::RollThread(InspIRCd* Instance, ModuleRoll* Me, uint64_t key, size_t cachesize) : SocketThread(), ServerInstance(Instance), ModuleInstance(Me), Key(key), CacheSize(cachesize)
+{
+	RE.SetGenerator(new PhiloxGenerator(Key));
+	RE.SetExpressionCacheCapacity(CacheSize);
+}
+
+
+
 /* Add a roll to the back of the roll thread's incoming queue. */
 /* Returns whether the add was rejected due to the queue being full. */
 /* Run by main thread. */
@@ -1270,7 +1500,7 @@ bool RollThread::AddRoll(UserRoll* roll)
 	}
 	this->UnlockQueueWakeup();
 	if (added)
-		ServerInstance->Logs->Log("m_roleplay", DEBUG, "Inserting roll from %s, target \"%s\", into incoming roll queue: %s", roll->source.c_str(), roll->target.c_str(), roll->expression[0].c_str());
+		ServerInstance->Logs->Log("m_roleplay", DEBUG, "Inserting roll %llu from %s, target \"%s\", into incoming roll queue: %s", (unsigned long long)roll->sequence, roll->source.c_str(), roll->target.c_str(), roll->expression[0].c_str());
 	else
 		ServerInstance->Logs->Log("m_roleplay", DEBUG, "NOT Inserting roll from %s, target \"%s\", into incoming roll queue, QUEUE FULL.", roll->source.c_str(), roll->target.c_str());
 
@@ -1335,7 +1565,12 @@ void RollThread::OnNotify()
 			}
 		}
 		
-		ModuleInstance->SendResults(user, targetuser, targetchan, *results);
+		/* The lines rendered by the roll thread are sent if they are
+		 * still right for the recipients. */
+		const std::vector<RenderedLine>* rendered = NULL;
+		if (results->RenderedFor(user, targetuser, targetchan))
+			rendered = &results->rendered;
+		ModuleInstance->SendResults(user, targetuser, targetchan, *results, rendered);
 		delete results;
 	}
 }
@@ -1381,7 +1616,14 @@ void RollThread::Run()
 		results->target = roll->target;
 
 		/* Roll it! */
-		RE.Run(*roll, *results);
+		if (roll->type == SIM)
+			RunSimulation(roll, results);
+		else
+			RE.Run(*roll, *results);
+
+		/* Render the lines to send for the results here, so the main
+		 * thread need only write them out. */
+		results->Render(*roll);
 
 		/* Now done with this roll, delete it. */
 		delete roll;
@@ -1417,4 +1659,62 @@ void RollThread::Run()
 
 
 
+/* Return the number of cores available to split simulations between. */
+static unsigned long CountCores()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores > 0)
+		return cores;
+#endif
+	return 1;
+}
+
+
+
+/* Run a simulation, with a worker thread per core each running a share of the
+ * trials on its own engine and generator, then merge their tallies. Each
+ * worker's generator runs on a substream of the simulation's own stream, so
+ * the simulation can be replayed given the same number of workers. */
+/* Run by roll thread. */
+void RollThread::RunSimulation(UserRoll* roll, UserRollResults* results)
+{
+	Roll trial;
+	unsigned long trials;
+	if (!RE.PrepareSimulation(*roll, *results, trial, trials))
+		return;
+
+	/* Small simulations aren't worth starting many threads for. */
+	unsigned long workercount = std::min(CountCores(), (unsigned long)MAX_SIM_WORKERS);
+	workercount = std::max(std::min(workercount, trials / MIN_SIM_WORKER_TRIALS), 1UL);
+
+	/* Start the workers, each on a substream of its own; substream zero
+	 * was used by PrepareSimulation(). */
+	std::vector<SimulationWorker*> workers;
+	for (unsigned long i = 0; i < workercount; i++)
+	{
+		PhiloxGenerator* stream = new PhiloxGenerator(Key);
+		stream->BeginRoll(roll->sequence);
+		stream->SetSubstream(i + 1);
+
+		unsigned long share = trials / workercount + (i < trials % workercount ? 1 : 0);
+		SimulationWorker* worker = new SimulationWorker(trial, share, stream, CacheSize);
+		ServerInstance->Threads->Start(worker);
+		workers.push_back(worker);
+	}
+
+	/* Wait for them all to finish, and combine their results. */
+	SimulationTally tally;
+	for (unsigned long i = 0; i < workercount; i++)
+	{
+		workers[i]->join();
+		tally.Merge(workers[i]->tally);
+		delete workers[i];
+	}
+
+	RE.ReportSimulation(*roll, tally, *results);
+}
+
+
+
 MODULE_INIT(ModuleRoll)
@@ -0,0 +1,189 @@
+/* RollEngine number formatting functions. */
+#include "rollengine.h"
+
+
+
+/* The two digits of every number below 100, so digits can be written out two
+ * at a time. */
+static const char digitpairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* The powers of ten up to the largest number of digits written directly. All
+ * of these are exact as doubles. */
+static const double powers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13
+};
+
+
+
+/* Write the digits of a number backwards from end, returning the start of
+ * them. */
+static char* WriteDigits(char* end, uint64_t number)
+{
+	while (number >= 100)
+	{
+		const char* pair = digitpairs + number % 100 * 2;
+		number /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	if (number >= 10)
+	{
+		const char* pair = digitpairs + number * 2;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	else
+		*--end = '0' + number;
+	return end;
+}
+
+
+
+/* Pad a number to width with zeros on the left, returning its new length. */
+static size_t Pad(char* buffer, size_t length, unsigned int width)
+{
+	if (width >= NUMBER_LENGTH)
+		width = NUMBER_LENGTH - 1;
+	if (length >= width)
+		return length;
+
+	size_t padding = width - length;
+	memmove(buffer + padding, buffer, length + 1);
+	memset(buffer, '0', padding);
+	return width;
+}
+
+
+
+/* Write a number with exactly ten significant digits in fixed notation, as
+ * "%.10g" would, returning its length, or 0 if it must be left to snprintf().
+ * That is any number of at least 1e10, which "%.10g" writes in exponent form,
+ * and any number below 1e-4, which it writes in exponent form too. */
+static size_t WriteFixed(char* buffer, double number)
+{
+	double magnitude = fabs(number);
+	if (!(magnitude >= 1e-4 && magnitude < 1e10))
+		return 0;
+
+	/* Find the power of ten of the leading digit, and scale the number so
+	 * its ten significant digits are its whole part. The powers used are
+	 * exact, so the scaled number is within a rounding of the true one;
+	 * if that could change which way its last digit rounds, leave it to
+	 * snprintf(), as it must if the power of ten was misjudged. */
+	int exponent = (int)floor(log10(magnitude));
+	exponent = std::min(std::max(exponent, -4), NUMBER_DIGITS - 1);
+
+	int shift = NUMBER_DIGITS - 1 - exponent;
+	double scaled = magnitude * powers[shift];
+	double whole = floor(scaled);
+	if (whole < 1e9 || whole >= 1e10 || fabs(scaled - whole - 0.5) < 1e-5)
+		return 0;
+	uint64_t digits = (uint64_t)whole + (scaled - whole > 0.5);
+
+	/* Rounding up may carry into another digit. */
+	if (digits == 10000000000ULL)
+	{
+		if (exponent == NUMBER_DIGITS - 1)
+			return 0;
+		digits /= 10;
+		exponent++;
+		shift--;
+	}
+
+	/* Trailing zeros after the point are left out, and the point too if
+	 * nothing follows it. */
+	while (shift && digits % 10 == 0)
+	{
+		digits /= 10;
+		shift--;
+	}
+
+	char scratch[NUMBER_LENGTH];
+	char* end = scratch + sizeof(scratch);
+	char* start = WriteDigits(end, digits);
+	size_t count = end - start;
+
+	char* position = buffer;
+	if (number < 0)
+		*position++ = '-';
+	if (exponent < 0)
+	{
+		/* Numbers below 1 are written as "0.", the zeros after the point,
+		 * and the digits. */
+		*position++ = '0';
+		*position++ = '.';
+		for (int zeros = -exponent - 1; zeros; zeros--)
+			*position++ = '0';
+		memcpy(position, start, count);
+		position += count;
+	}
+	else
+	{
+		size_t before = count - shift;
+		memcpy(position, start, before);
+		position += before;
+		if (shift)
+		{
+			*position++ = '.';
+			memcpy(position, start + before, shift);
+			position += shift;
+		}
+	}
+	*position = '\0';
+	return position - buffer;
+}
+
+
+
+size_t FormatNumber(char* buffer, double number, unsigned int width)
+{
+	/* Whole numbers of up to ten digits are written out in full. */
+	if (number > -1e10 && number < 1e10 && number == ::trunc(number))
+	{
+		size_t length;
+		if (number == 0 && signbit(number))
+		{
+			strcpy(buffer, "-0");
+			length = 2;
+		}
+		else
+			length = FormatInteger(buffer, (int64_t)number);
+		return Pad(buffer, length, width);
+	}
+
+	size_t length = WriteFixed(buffer, number);
+	if (!length)
+		length = snprintf(buffer, NUMBER_LENGTH, "%.10g", number);
+	return Pad(buffer, length, width);
+}
+
+
+
+size_t FormatInteger(char* buffer, int64_t number, unsigned int width)
+{
+	/* Numbers of more digits than are significant are written in exponent
+	 * form, as doubles. */
+	if (number <= -10000000000LL || number >= 10000000000LL)
+		return FormatNumber(buffer, (double)number, width);
+
+	char scratch[NUMBER_LENGTH];
+	char* end = scratch + sizeof(scratch);
+	char* start = WriteDigits(end, number < 0 ? -number : number);
+	if (number < 0)
+		*--start = '-';
+
+	size_t length = end - start;
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+	return Pad(buffer, length, width);
+}
@@ -0,0 +1,26 @@
+/* RollEngine number formatting header file. */
+#ifndef __NUMBERFORMAT_H__
+#define __NUMBERFORMAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The defined limits used in formatting numbers. */
+#define NUMBER_DIGITS 10 /* Significant digits numbers are shown to. */
+#define NUMBER_LENGTH 32 /* Room for the longest number written, and its NUL. */
+
+
+/* Write a number into buffer, which must have room for NUMBER_LENGTH
+ * characters, returning its length. Numbers are written exactly as printf's
+ * "%.10g" would, which is also how a stream with a precision of 10 writes
+ * them; whole numbers and numbers with up to ten significant digits in fixed
+ * notation are written directly, and only the rest go through snprintf().
+ * If the number is shorter than width, it is padded to it with zeros on the
+ * left, as a stream with a fill of '0' would. */
+size_t FormatNumber(char* buffer, double number, unsigned int width = 0);
+
+/* Write a whole number into buffer, just as FormatNumber() would write it as a
+ * double. */
+size_t FormatInteger(char* buffer, int64_t number, unsigned int width = 0);
+
+#endif
@@ -14,6 +14,9 @@ public:
 	 * contain at least some lines which are not ERROR, KICK, or SHUN. These
 	 * lines will only ever be seen locally. All others will be seen
 	 * globally, and in the correct order.
+	 * The preset and roll data of the results, giving the numbers behind
+	 * the lines, are only present on the server the roll was made on;
+	 * elsewhere, the results have only their lines, and PRESET_NONE.
 	 * @param u User that is doing the rolling.
 	 * @param target Channel receiving the roll.
 	 * @param results The results structure of the roll.
@@ -3,54 +3,11 @@
 
 RollEngine::RollEngine()
 {
-	seed = time(NULL);
+	generator = new XoshiroGenerator(time(NULL));
 	expression = new ExpressionParser(this);
-
-	/* Insert all our constants into the map. */
-	constants.insert(std::pair<const char*, double>("pi", M_PI));
-	constants.insert(std::pair<const char*, double>("i", 1));
-	constants.insert(std::pair<const char*, double>("ii", 2));
-	constants.insert(std::pair<const char*, double>("iii", 3));
-	constants.insert(std::pair<const char*, double>("iv", 4));
-	constants.insert(std::pair<const char*, double>("v", 5));
-	constants.insert(std::pair<const char*, double>("vi", 6));
-	constants.insert(std::pair<const char*, double>("vii", 7));
-	constants.insert(std::pair<const char*, double>("viii", 8));
-	constants.insert(std::pair<const char*, double>("ix", 9));
-	constants.insert(std::pair<const char*, double>("x", 10));
-	
-	/* Insert all our functions into the function map. */
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("abs(", &RollEngine::abs));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("acos(", &RollEngine::acos));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("asin(", &RollEngine::asin));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("atan(", &RollEngine::atan));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("ceil(", &RollEngine::ceil));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("cos(", &RollEngine::cos));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("cosh(", &RollEngine::cosh));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("deg(", &RollEngine::deg));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("exp(", &RollEngine::exp));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("fac(", &RollEngine::fac));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("floor(", &RollEngine::floor));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("log(", &RollEngine::log));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("log10(", &RollEngine::log10));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("rad(", &RollEngine::rad));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("ran(", &RollEngine::ran));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("round(", &RollEngine::round));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("sin(", &RollEngine::sin));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("sinh(", &RollEngine::sinh));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("sqr(", &RollEngine::sqr));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("sqrt(", &RollEngine::sqrt));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("tan(", &RollEngine::tan));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("tanh(", &RollEngine::tanh));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("trunc(", &RollEngine::trunc));
-	
-	/* Insert alias function names into the function map. */
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("logten(", &RollEngine::log10));
-	functions.insert(std::pair<const char*, double(RollEngine::*)(double)>("todeg(", &RollEngine::deg));
-
-	/* Increase the output precision (maximum digits shown) when converting
-	 * numbers to strings. */
-	convstream.precision(10);
+	resultline.reserve(RESULT_LINE_LENGTH);
+	recording = false;
+	holding = false;
 
 	/* Determine how distracted the fuzz are... */
 	fuzzfactor = RollTheBones(1, 100);
@@ -58,36 +15,65 @@ RollEngine::RollEngine()
 
 
 void RollEngine::Run(const Roll& passed_roll, RollResults& passed_results)
+{
+	generator->BeginRoll(passed_roll.sequence);
+	recording = true;
+	Perform(passed_roll, passed_results);
+}
+
+
+void RollEngine::Perform(const Roll& passed_roll, RollResults& passed_results)
 {
 	roll = &passed_roll;
 	results = &passed_results;
 	warning_count = 0;
+	outcome_recorded = false;
+	outcome_expression = false;
+	expression_cost = 0;
 
-	try {
-		if (roll->type == CALC)
-			RollExpression();
-		else if (roll->type == ROLL)
-			DoRoll();
-		else if (roll->type == SCORES)
-			DoScores();
-	}
-	catch (RollException* boom)
-	{
-		delete boom;
-		/* Just quietly return, terminating handling of the roll.  */
-	}
+	/* Anything which fails sets the results to its errors, and returns
+	 * straight back here. */
+	if (roll->type == CALC)
+		RollExpression();
+	else if (roll->type == ROLL)
+		DoRoll();
+	else if (roll->type == SCORES)
+		DoScores();
+	else if (roll->type == ODDS)
+		DoOdds();
+	else if (roll->type == SIM)
+		DoSimulate();
 }
 
 
-double RollEngine::ReadExpression(const std::string& expression_string)
+bool RollEngine::Validate(const Roll& passed_roll, RollResults& passed_results)
+{
+	roll = &passed_roll;
+	results = &passed_results;
+	warning_count = 0;
+
+	/* Only plain expressions are checked; the special RPG expressions
+	 * ReadExpression() handles always run. */
+	if (roll->type != CALC && (roll->type != ROLL || FindPreset() || IsRepeatedExpression()))
+		return true;
+	const std::string& expression_string = roll->expression[0];
+	if (expression_string == "%" || !strcasecmp(expression_string.c_str(), "d%HL") || !strcasecmp(expression_string.c_str(), "%HL"))
+		return true;
+
+	return expression->Validate(expression_string.c_str());
+}
+
+
+bool RollEngine::ReadExpression(const std::string& expression_string, double& value)
 {
 	/* Handle special RPG expressions the parser cannot handle. */
 	/* These must not be system-specific presets, must not produce more
 	 * than one result, and must not require a special output format. */
+	expression_parsed = false;
 	if (expression_string == "%")
 	{
 		/* "%" means 1d100. */
-		return RollTheBones(1, 100);
+		value = RollTheBones(1, 100);
 	}
 	else if (!strcasecmp(expression_string.c_str(), "d%HL") || !strcasecmp(expression_string.c_str(), "%HL"))
 	{
@@ -100,17 +86,105 @@ double RollEngine::ReadExpression(const std::string& expression_string)
 		double tens = RollTheBones(1, 10) - 1;
 		double ones = RollTheBones(1, 10) - 1;
 		if (!tens && !ones)
-			return 100;
+			value = 100;
 		else
-			return tens * 10 + ones;
+			value = tens * 10 + ones;
+	}
+	else
+	{
+		/* Parse the expression normally, if it was not handled as a
+		 * special case. */
+		if (!expression->Parse(expression_string.c_str()))
+			return false;
+		expression_parsed = true;
+		expression_cost += expression->Cost;
+
+		/* Return the results. */
+		value = expression->Eval();
+	}
+
+	if (recording)
+		results->AddExpression(expression_string, value);
+	return true;
+}
+
+
+void RollEngine::RecordOutcome(double value, bool botched)
+{
+	outcome_recorded = true;
+	outcome_botched = botched;
+	outcome = value;
+	if (recording)
+		results->AddOutcome(value, botched);
+}
+
+
+void RollEngine::RecordDice(const uint32_t* faces, size_t count, unsigned int sides)
+{
+	if (!recording)
+		return;
+	if (holding)
+	{
+		HoldDice(holding_lane, sides, count);
+		HoldFaces(holding_lane, faces, count);
+		return;
+	}
+	results->AddDice(sides, count);
+	results->AddFaces(faces, count);
+}
+
+
+void RollEngine::HoldDice(size_t lane, unsigned int sides, size_t count)
+{
+	std::vector<uint32_t>& held = held_dice[lane];
+	held_roll[lane] = held.size();
+	held.push_back(sides);
+	held.push_back((uint32_t)count);
+	held.push_back(0);
+}
+
+
+void RollEngine::HoldFaces(size_t lane, const uint32_t* faces, size_t count)
+{
+	std::vector<uint32_t>& held = held_dice[lane];
+	if (held.size() >= MAX_RESULT_VALUES)
+		return;
+	count = std::min(count, MAX_RESULT_VALUES - held.size());
+
+	held.insert(held.end(), faces, faces + count);
+	held[held_roll[lane] + 2] += count;
+}
+
+
+void RollEngine::RecordHeldDice(size_t lane)
+{
+	std::vector<uint32_t>& held = held_dice[lane];
+	for (size_t item = 0; item < held.size(); item += 3 + held[item + 2])
+	{
+		results->AddDice(held[item], held[item + 1]);
+		results->AddFaces(&held[0] + item + 3, held[item + 2]);
 	}
+	held.clear();
+}
+
 
-	/* Parse the expression normally, if it was not handled as a special
-	 * case. */
-	expression->Parse(expression_string.c_str());
-	
-	/* Return the results. */
-	return expression->Eval();
+void RollEngine::SetGenerator(RandomGenerator* gen)
+{
+	delete generator;
+	generator = gen;
+}
+
+
+void RollEngine::SetExpressionCacheCapacity(size_t capacity)
+{
+	expression->SetCacheCapacity(capacity);
+}
+
+
+void RollEngine::GetExpressionCacheStats(unsigned long& hits, unsigned long& misses) const
+{
+	hits = expression->CacheHits;
+	misses = expression->CacheMisses;
 }
 
 
@@ -144,15 +218,72 @@ const std::string& RollEngine::For()
 
 const std::string& RollEngine::Str(double number)
 {
-	convstream.str(""); convstream.clear();
-	convstream << number; convstream >> convstring;
+	convstring.assign(convbuffer, FormatNumber(convbuffer, number));
 	return convstring;
 }
 const std::string& RollEngine::Str(double number, const std::string& input)
 {
-	convstream.str(""); convstream.clear();
-	convstream << number; convstream >> convstring;
+	convstring.assign(convbuffer, FormatNumber(convbuffer, number));
 	if (convstring != input)
 		convstring += " (" + input + ")";
 	return convstring;
 }
+const std::string& RollEngine::IntegerStr(int64_t number)
+{
+	convstring.assign(convbuffer, FormatInteger(convbuffer, number));
+	return convstring;
+}
+
+
+void RollEngine::BeginLine(const char* text)
+{
+	resultline.clear();
+	resultline += text;
+}
+void RollEngine::AppendText(const char* text)
+{
+	resultline += text;
+}
+void RollEngine::AppendText(const std::string& text)
+{
+	resultline += text;
+}
+void RollEngine::AppendNumber(double number)
+{
+	resultline.append(convbuffer, FormatNumber(convbuffer, number));
+}
+void RollEngine::AppendNumber(double number, const std::string& input)
+{
+	size_t length = FormatNumber(convbuffer, number);
+	resultline.append(convbuffer, length);
+	if (input.compare(0, std::string::npos, convbuffer, length))
+	{
+		resultline += " (";
+		resultline += input;
+		resultline += ")";
+	}
+}
+void RollEngine::AppendPadded(double number, unsigned int width)
+{
+	resultline.append(convbuffer, FormatNumber(convbuffer, number, width));
+}
+void RollEngine::AppendInteger(int64_t number)
+{
+	resultline.append(convbuffer, FormatInteger(convbuffer, number));
+}
+void RollEngine::AppendFor()
+{
+	if (roll->outputtype == IRC_CHAN || roll->outputtype == IRC_PM)
+	{
+		resultline += " for ";
+		resultline += roll->extra[0];
+	}
+}
+void RollEngine::AppendMessage(size_t first)
+{
+	for (size_t i = first; i < roll->expression.size(); i++)
+	{
+		resultline += " ";
+		resultline += roll->expression[i];
+	}
+}
@@ -4,12 +4,12 @@
 
 #include <limits.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
 #include <algorithm>
-#include <iomanip>
 #include <limits>
 #include <list>
 #include <map>
@@ -17,7 +17,10 @@
 #include <sstream>
 #include <vector>
 
+#include "distribution.h"
 #include "expressionparser.h"
+#include "numberformat.h"
+#include "rollrandom.h"
 
 /* Define string comparison function for Windows. This is ugly, but needed
  * because there's no portable way of doing this. */
@@ -25,6 +28,32 @@
 #define strcasecmp _stricmp
 #endif
 
+/* The defined limits used in rolling dice pools. */
+#define MAX_POOL_DICE 10000 /* Maximum dice in one pool. */
+#define MAX_POOL_SHOWN 40   /* Maximum dice shown individually in a pool. */
+
+/* The default number of compiled expressions each engine keeps for reuse. */
+#define EXPRESSION_CACHE_SIZE 64
+
+/* The room made for results when the first line is added, enough for most
+ * rolls to need no more. */
+#define RESULT_LINES 8   /* Lines of results. */
+#define RESULT_TEXT 1024 /* Characters of text for them. */
+#define RESULT_DATA 8    /* Items of roll data. */
+#define RESULT_VALUES 64 /* Values for them. */
+
+/* The most values recorded as roll data for one roll; dice faces past these
+ * are left out. */
+#define MAX_RESULT_VALUES 1000
+
+/* The room kept for building a line of results; that of a whole IRC line. */
+#define RESULT_LINE_LENGTH 512
+
+/* The defined limits used in simulating rolls. */
+#define MAX_SIM_TRIALS 1000000 /* Maximum trials in one simulation. */
+#define MAX_SIM_OUTCOMES 20    /* Maximum distinct outcomes listed in full. */
+#define MAX_SIM_WORK 100000000 /* Maximum worst case dice and steps in all trials. */
+
 
 /* Roll types. These define how the expression is to be interpreted.
  * - CALC: To be interpreted as a mathematical expression, possibly including
@@ -32,8 +61,16 @@
  * - ROLL: To be interpreted as a normal dice roll, either an expression as
  *   compatible with CALC, or one of the supported preset rolls.
  * - SCORES: To be interpreted as a request for a set of character scores to be
- *   randomly generated for the specified system and method. */
-enum RollType { CALC, ROLL, SCORES };
+ *   randomly generated for the specified system and method.
+ * - ODDS: To be interpreted as a mathematical expression as for CALC, for
+ *   which the exact odds of each result are calculated instead of rolling
+ *   it. An optional second parameter gives a target to find the chance of
+ *   meeting or beating.
+ * - SIM: To be interpreted as a number of trials, followed by a roll as for
+ *   ROLL, which is performed that many times to summarise its outcomes. Only
+ *   rolls with a single numerical outcome, such as dice pools and
+ *   expressions, can be simulated. */
+enum RollType { CALC, ROLL, SCORES, ODDS, SIM };
 
 
 
@@ -55,9 +92,8 @@ enum RollOutputType { PLAIN, IRC_SELF, IRC_CHAN, IRC_PM };
 /* Result type. This specifies the type of a given result line, and thus how it
  * is meant to be displayed. In fitting with the roleplaying design of
  * RollEngine, results may be displayed or expressed in a number of ways,
- * depending on the output type. Each type may have multiple strings added to
- * the data vector per type added to the type vector, providing multiple pieces
- * of information for a single line or result effect.
+ * depending on the output type. Each line has its text, and some types have an
+ * extra piece of text, providing more information for the line or effect.
  * - ERR: This is a message to be shown to the requester of the roll to tell
  *   them of an error in or an error performing the roll. This must be supported
  *   by all output types.
@@ -65,29 +101,66 @@ enum RollOutputType { PLAIN, IRC_SELF, IRC_CHAN, IRC_PM };
  *   all output types.
  * - ACTION: This is a message to be displayed as an action, or an emote, by the
  *   the rolling system. This is must be supported for all IRC output types.
- * - NPC: This is a message from an NPC. The data vector contains the message,
- *   and the name for the NPC. This must be supported for IRC_CHAN.
- * - NPCA: This is a message displayed as an action by an NPC. The data vector
- *   contains the action text, and the name for the NPC. This must be supported
- *   for IRC_CHAN.
- * - SCENE: This is a message displayed as a SCENE message. The data vector
- *   contains the message.
+ * - NPC: This is a message from an NPC. The text is the message, and the extra
+ *   text the name for the NPC. This must be supported for IRC_CHAN.
+ * - NPCA: This is a message displayed as an action by an NPC. The text is the
+ *   action text, and the extra text the name for the NPC. This must be
+ *   supported for IRC_CHAN.
+ * - SCENE: This is a message displayed as a SCENE message. The text is the
+ *   message.
  * - KICK: This line is an instruction for the requester to be removed from the
- *   channel they are messaging. The data vector contains the reason for the
- *   removal. This must be supported for IRC_CHAN.
+ *   channel they are messaging. The text is the reason for the removal. This
+ *   must be supported for IRC_CHAN.
  * - SHUN: This line is an instruction for the requester to be shunned. The
- *   data vector contains the duration of the shun, and the reason. This must
+ *   text is the reason, and the extra text the duration of the shun. This must
  *   be supported for all IRC output types. */
 enum RollResultType { ERR, MESSAGE, ACTION, NPC, NPCA, SCENE, KICK, SHUN };
 
 
 
+/* Roll presets. These identify the kind of roll which produced a set of
+ * results, so callers can tell what their roll data means without reading the
+ * text. Each preset ROLL has its own, as do plain and repeated expressions,
+ * whether from CALC or ROLL; all the easter eggs share one, as do all SCORES,
+ * ODDS and SIM rolls. Results of no roll have PRESET_NONE. */
+enum RollPreset { PRESET_NONE, PRESET_EXPRESSION, PRESET_REPEATED_EXPRESSION,
+	PRESET_CRAPS, PRESET_D20, PRESET_EXALTED, PRESET_EXALTED2,
+	PRESET_NEW_HORIZONS, PRESET_RTD, PRESET_SHADOWRUN, PRESET_WOD,
+	PRESET_RWOD, PRESET_NWOD, PRESET_NWOD_CHANCE, PRESET_DND2E_INIT,
+	PRESET_DND_ALIAS, PRESET_EASTER_EGG, PRESET_SCORES, PRESET_ODDS,
+	PRESET_SIMULATION };
+
+
+
+/* Roll data types. Alongside its lines, a roll's results record the numbers
+ * behind them as items of roll data, each of a type specifying what its values
+ * are. Items are recorded in the order their numbers come up in the roll.
+ * - DATA_EXPRESSION: An expression read for the roll; the roll itself, one of
+ *   a repeated expression's rolls, or a numerical parameter to a preset. The
+ *   text is the expression, and the one value its result. Any dice rolled for
+ *   it come before it.
+ * - DATA_DICE: A roll of dice. The values are the sides, the number of dice,
+ *   and the face each die came up on, in the order rolled. A die whose
+ *   explosions add to it shows the total of its whole chain, and faces past
+ *   MAX_RESULT_VALUES values in all are left out.
+ * - DATA_FACE_COUNTS: A pool of dice rolled in summary. The values are the
+ *   sides, and how many dice showed each face, from 1 up.
+ * - DATA_SUCCESSES: The successes of a pool roll; the one value.
+ * - DATA_BOTCHES: The botches of a pool roll; the one value.
+ * - DATA_OUTCOME: The single numerical outcome of the roll, as a simulation of
+ *   it would count it. The values are the outcome, and 1 if it botched or 0 if
+ *   not. */
+enum RollDataType { DATA_EXPRESSION, DATA_DICE, DATA_FACE_COUNTS, DATA_SUCCESSES, DATA_BOTCHES, DATA_OUTCOME };
+
+
+
 /* Class declarations. */
 class Roll;
+class RollResultLine;
+class RollDataItem;
 class RollResults;
-class RollException;
+class SimulationTally;
 class ExpressionParser;
-class StackDepthCounter;
 class RollEngine;
 
 
@@ -115,26 +188,96 @@ class Roll
 	/* Extra information for the output type that RollEngine may use in
 	 * generating messages. */
 	std::vector<std::string> extra;
+
+	/* The sequence number of the roll, passed to the generator at the
+	 * start of the roll. With a stream-per-roll generator, rolls with the
+	 * same sequence number and generator key have the same results, so
+	 * each roll should be given a unique one. */
+	uint64_t sequence;
+
+	Roll() : sequence(0) { }
+};
+
+
+
+/* RollResultLine Class */
+/* A line of roll results. Its text is kept in the text buffer of the results
+ * it belongs to, and found by its offset there, so lines stay valid as the
+ * buffer grows, and when the results are copied. */
+class RollResultLine
+{
+ public:
+	/* The type of the line, telling the caller how to display it. */
+	RollResultType type;
+
+	/* The offsets and lengths of the line's text and extra text. Each is
+	 * followed by a NUL in the buffer; the extra text is empty for types
+	 * without one. */
+	uint32_t text;
+	uint32_t text_length;
+	uint32_t extra;
+	uint32_t extra_length;
+};
+
+
+
+/* RollDataItem Class */
+/* An item of roll data. Like a line, it is kept in the results it belongs to;
+ * its text in their text buffer, and its values in their values, each found
+ * by offset. */
+class RollDataItem
+{
+ public:
+	/* The type of the item, telling the caller what its values are. */
+	RollDataType type;
+
+	/* The offset and length of the item's text, followed by a NUL in the
+	 * buffer; empty for types without one. */
+	uint32_t text;
+	uint32_t text_length;
+
+	/* The offset and number of the item's values. Every item has at least
+	 * one. */
+	uint32_t first;
+	uint32_t count;
 };
 
 
 
 /* RollResults Class */
 /* Stores the results for a roll. RollEngine takes a reference to one to fill
- * with results. */
+ * with results. The lines are kept in one array, and their text in one buffer,
+ * so most results take just the two allocations made for the first line. The
+ * roll data is kept the same way, so callers wanting the numbers of a roll
+ * need not read them back out of the text. */
 class RollResults
 {
  public:
-	/* The types of each line of results. There is one entry here per result
-	 * line. These are set by RollEngine and used to tell the caller how 
-	 * to display its output. This should be iterated over, and the data
-	 * for each line pulled out, in order. */
-	std::list<RollResultType> types;
+	RollResults() : preset(PRESET_NONE) { }
+
+	/* The lines of results, in order. These are set by RollEngine and used
+	 * to tell the caller how to display its output. This should be
+	 * iterated over, and the text for each line looked up, in order. */
+	std::vector<RollResultLine> lines;
+
+	/* The text of every line and item of roll data, each piece followed by
+	 * a NUL. */
+	std::vector<char> buffer;
+
+	/* The preset of the roll, and its roll data, in order, with the
+	 * values of every item. Roll data is only recorded by Run(); the
+	 * trials of a simulation record none. */
+	RollPreset preset;
+	std::vector<RollDataItem> data;
+	std::vector<double> values;
+
+	/* Look up the text and extra text of a line of these results. */
+	const char* Text(const RollResultLine& line) const { return &buffer[line.text]; }
+	const char* Extra(const RollResultLine& line) const { return &buffer[line.extra]; }
 
-	/* The results data. Some types of result line may have multiple pieces
-	 * of data, rather than one, associated with them, in order to provide
-	 * additional information. */
-	std::list<std::string> data;
+	/* Look up the text and values of an item of roll data. */
+	const char* Text(const RollDataItem& item) const { return &buffer[item.text]; }
+	const double* Values(const RollDataItem& item) const { return &values[item.first]; }
 
 	/* Functions to add lines to the results. */
 	/* Will not check that these are appropriate for the output type. */
@@ -147,19 +290,63 @@ class RollResults
 	void AddKick(const std::string& reason);
 	void AddShun(const std::string& reason, const int& duration);
 
-	/* Function to clear the results. */
+	/* Functions to add roll data to the results. AddDice() begins an item
+	 * for a roll of dice, and AddFaces() adds faces to the latest, up to
+	 * MAX_RESULT_VALUES values in all. */
+	void AddExpression(const std::string& expression, double value);
+	void AddDice(unsigned int sides, size_t count);
+	void AddFaces(const uint32_t* faces, size_t count);
+	void AddFaceCounts(const unsigned int* faces, unsigned int sides);
+	void AddSuccesses(double successes);
+	void AddBotches(double botches);
+	void AddOutcome(double outcome, bool botched);
+
+	/* Function to clear the results' lines and roll data, keeping the
+	 * preset. */
 	/* Used before adding fatal error messages. */
 	void Clear();
+
+ private:
+	/* Add a line of the given type, copying its text into the buffer. */
+	void AddLine(RollResultType type, const char* text, size_t text_length, const char* extra, size_t extra_length);
+	uint32_t AddText(const char* text, size_t length);
+
+	/* Add an item of roll data of the given type, with the given text and
+	 * room for count values, returning where its values go. */
+	double* AddData(RollDataType type, const char* text, size_t text_length, size_t count);
 };
 
 
 
-/* RollException is a do-nothing class that is simply thrown to terminate
- * processing of a roll on error. The function throwing it is responsible for
- * clearing the previous messages from the roll results object, and then adding
- * error messages for the fatal error, beforehand. This is caught by RollEngine
- * in Run(), which simply returns. */
-class RollException {};
+/* SimulationTally Class */
+/* Counts the outcomes of the trials of a simulation. Tallies of the same roll
+ * simulated by separate engines may be merged, so simulations can be split
+ * across threads. */
+class SimulationTally
+{
+ public:
+	/* Number of trials counted, and how many of them botched. */
+	unsigned long trials;
+	unsigned long botches;
+
+	/* Sum of all outcomes, for the mean. */
+	double total;
+
+	/* Number of trials with each outcome. */
+	std::map<double, unsigned long> outcomes;
+
+	SimulationTally() : trials(0), botches(0), total(0) { }
+
+	/* Count the outcome of one trial. */
+	void Add(double outcome, bool botched);
+
+	/* Add the counts of another tally of the same roll to this one. */
+	void Merge(const SimulationTally& other);
+
+	/* Return the lowest outcome at least the given fraction of trials had
+	 * or were below. There must have been at least one trial. */
+	double Percentile(double fraction) const;
+};
 
 
 
@@ -170,29 +357,73 @@ class RollException {};
  *
  * RollEngine's expression parser is designed for efficiency. It may and
  * should be reused for new expressions after the result of a previous
- * expression is has been retrieved, and will never allocate/deallocate memory
- * on the heap outside of construction and destruction. */
+ * expression is has been retrieved. It keeps the most recently parsed
+ * expressions compiled in a cache, so expressions rolled again are not parsed
+ * again, and allocates memory on the heap only to add an expression to the
+ * cache. */
 class ExpressionParser
 {
- friend class StackDepthCounter;
-
  public:
 	/* Constructor. Initalises the parent RE. */
-	ExpressionParser(RollEngine* RE) { engine = RE; }
+	ExpressionParser(RollEngine* RE) : CacheHits(0), CacheMisses(0), CacheCapacity(EXPRESSION_CACHE_SIZE) { engine = RE; }
 
 	/* Take an infix expression in a string and parses it, storing the
-	 * result inside the parser for evaluation.
-	 * Throws RollException for errors in the expression. */
-	void Parse(const char* expression);
+	 * result inside the parser for evaluation. If the same expression was
+	 * parsed recently, the compiled expression is taken from the cache
+	 * instead.
+	 * Returns false after setting the roll's results to the errors if
+	 * the expression is invalid. */
+	bool Parse(const char* expression);
+
+	/* Parse an expression only to check it, failing exactly as Parse()
+	 * would. Nothing is compiled, cached or allocated, and the expression
+	 * parsed before is left unusable. */
+	bool Validate(const char* expression);
+
+	/* Set the most compiled expressions to keep in the cache, dropping the
+	 * least recently used ones if there are too many. A capacity of 0
+	 * disables the cache. */
+	void SetCacheCapacity(size_t capacity);
+
+	/* The number of Parse() calls that found their expression in the
+	 * cache, and that had to parse it, while the cache was enabled. */
+	unsigned long CacheHits;
+	unsigned long CacheMisses;
+
+	/* The worst case cost of evaluating the current expression once, in
+	 * dice rolled and steps taken, as worked out by Parse() from the
+	 * bounds of every value in it. Parse() rejects expressions costing
+	 * more than MAX_EXP_COST. */
+	double Cost;
+
+	/* Whether every value in the current expression is always a whole
+	 * number of at most MAX_EXACT_INTEGER, as worked out by Parse()
+	 * alongside the cost. Eval() evaluates such expressions in int64_t,
+	 * with the same results as in double, and their results may be
+	 * formatted with RollEngine::IntegerStr(). */
+	bool Integral;
 
 	/* Evaluates the current expression stored in the parser. Must only be
-	 * called after a successful Parse() call which did not trigger an
-	 * exception. Returns the result of evaluation as a double. */
+	 * called after a successful Parse() call. Returns the result of
+	 * evaluation as a double. */
 	double Eval();
 
+	/* Evaluates the current expression count times, as with count calls
+	 * to Eval(), storing the results in results. The trials are evaluated
+	 * EVAL_LANES at a time, each operation running across all of them,
+	 * with the dice for each dice roll in them rolled together. */
+	void EvalBatch(size_t count, double* results);
+
+	/* Calculates the exact distribution of results of the current
+	 * expression, without rolling any dice, storing it in result. Has the
+	 * same requirements as Eval(). Returns false after setting the roll's
+	 * results to the error for expressions whose odds cannot be
+	 * calculated. */
+	bool EvalDistribution(Distribution& result);
+
  private:
 	/* The parent RollEngine. This engine has error messages added on
-	 * exception to its roll, its math functions used, and so forth, and is
+	 * failure to its roll, its math functions used, and so forth, and is
 	 * assumed to be the caller. */
 	RollEngine* engine;
 
@@ -200,62 +431,157 @@ class ExpressionParser
 	ExpToken Expression[MAX_EXP_TOKENS];
 	size_t ExpressionLength;
 
+	/* Current compiled expression. */
+	EvalOp Compiled[MAX_EXP_TOKENS];
+	size_t CompiledLength;
+
+	/* The expression to evaluate, and its compiled form; either the ones
+	 * just parsed and compiled, or ones from the cache. */
+	const ExpToken* Program;
+	size_t ProgramLength;
+	const EvalOp* Code;
+	size_t CodeLength;
+
+	/* The cache of compiled expressions, most recently used first, and
+	 * the index of them by their text, pointing into the entries. */
+	class CachedExpression
+	{
+	 public:
+		std::string text;
+		std::vector<ExpToken> tokens;
+		std::vector<EvalOp> code;
+		double cost;
+		bool integral;
+	};
+	typedef std::list<CachedExpression> ExpressionCache;
+	typedef std::map<const char*, ExpressionCache::iterator, TextTokenCompare> ExpressionCacheIndex;
+	ExpressionCache Cache;
+	ExpressionCacheIndex CacheIndex;
+	size_t CacheCapacity;
+
 	/* Current parsing state. */
 	const char* string;
 	const char* ParsePosition;
 	ExpToken CurrentToken;
-	size_t ParseStackDepth;
-	char TextToken[MAX_TEXT_TOKEN];
+	ExpToken OperatorStack[MAX_OPERATOR_STACK];
+	size_t OperatorDepth;
+
+	/* The constants and functions, sorted by name so that ReadToken() can
+	 * walk them as a trie. */
+	static const ExpTextToken TextTokens[];
+	static const size_t TextTokenCount;
 
 	/* Current evaluation state. */
 	double EvalStack[MAX_NUM_STACK];
-	size_t EvalPosition;
-
-	/* Parsing subfunctions. */
-	/* These are called by Parse(). Each implements a level of precedence,
-	 * calling down to the level below them before adding tokens on
-	 * their level. */ 
-	void Level1();  /* Addition and subtraction. */
-	void Level2();  /* Multiplication and division. */
-	void Level3();  /* Exponent operator. */
-	void Level4();  /* Unary minus (plus is ignored). */
-	void Level5();  /* The dice operator. */
-	void Level6();  /* Numbers. */
+	int64_t IntegerStack[MAX_NUM_STACK];
 
-	/* Adds a token to the currently parsed expression. */
-	void AddToken(ExpToken& token);
+	/* Batch evaluation stack; a row of EVAL_LANES values for each number
+	 * on the stack, grown to fit the deepest expression evaluated. */
+	std::vector<double> BatchStack;
 
-	/* Reads the next token from the current string being parsed into
-	 * CurrentToken. */
-	void ReadToken();
+	/* The handlers for each token type, and for each binary operator with
+	 * its right-hand number inlined, indexed by token type. */
+	static const EvalHandler Handlers[];
+	static const EvalHandler InlinedHandlers[];
+	static const IntegerEvalHandler IntegerHandlers[];
+	static const IntegerEvalHandler IntegerInlinedHandlers[];
 
-	/* Generate an error message highlighting the position of the error
-	 * in the expression, along with the passed message, set it, and
-	 * throw a roll exception. */
-	void ThrowParseError(const char* message);
-};
+	/* Parses an expression into Expression, folding and analysing it,
+	 * for Parse() and Validate(). As with everything used in parsing
+	 * which can fail, returns false after setting the errors. */
+	bool ParseExpression(const char* expression_string);
 
+	/* Pushes an operator, parenthesis or function onto the operator
+	 * stack. */
+	bool PushOperator(ExpToken& token);
 
+	/* Pops operators with at least the given precedence off the operator
+	 * stack, adding them to the currently parsed expression. */
+	bool PopOperators(int precedence);
 
-/* Stack depth counter; every time this is instantiated, it increases the
- * recorded stack depth. When it's destroyed, it decrements it. If the stack
- * depth goes over limits, this throws an exception. An instance is created at
- * the start of all the functions that recurse in the expression parser; that
- * is, all the Level* functions and ReadToken. */
-class StackDepthCounter
-{
- public:
-	StackDepthCounter(ExpressionParser* const parent)
-	{
-		EP = parent;
-		EP->ParseStackDepth++;
-		if (EP->ParseStackDepth > MAX_STACK_DEPTH)
-			EP->ThrowParseError("Maximum recursion depth exceeded:");
-	}
-	~StackDepthCounter() { EP->ParseStackDepth--; }
+	/* Adds a token to the currently parsed expression. */
+	bool AddToken(ExpToken& token);
+
+	/* Replaces every part of the currently parsed expression that rolls
+	 * no dice with the NUMBER it evaluates to, so only dice and ran()
+	 * are left to be worked out when it is evaluated. */
+	void Fold();
+
+	/* Works out the worst case cost of the currently parsed expression,
+	 * and whether it is integral, by tracking the lowest and highest each
+	 * value in it could be, and fails if the cost is more than
+	 * MAX_EXP_COST. */
+	bool Analyse();
+
+	/* The bounds of the result of a function on a value with the given
+	 * bounds. */
+	static ExpBounds FunctionBounds(ExpMathFunc function, const ExpBounds& x);
+
+	/* Compiles the currently parsed expression for Eval(), to the integer
+	 * handlers if it is integral. */
+	void Compile();
+	void CompileIntegral();
+
+	/* Evaluates up to EVAL_LANES trials for EvalBatch(). */
+	void EvalLanes(size_t lanes, double* results);
+
+	/* Evaluation handlers, one for each operation in a compiled
+	 * expression. */
+	static double* EvalNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalAdd(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalSubtract(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalMultiply(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalDivide(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalModulo(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalExponent(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalNegate(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalDice(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalModifiedDice(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalFunction(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalRandom(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalAddNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalSubtractNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalMultiplyNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalDivideNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalModuloNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalExponentNumber(double* top, const EvalOp& op, RollEngine* engine);
+	static double* EvalDiceNumber(double* top, const EvalOp& op, RollEngine* engine);
+
+	/* Integer evaluation handlers, for whole number expressions. Those
+	 * for dice known to be within limits skip checking them. */
+	static int64_t* IntegerNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerAdd(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerSubtract(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerMultiply(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerModulo(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerNegate(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerDice(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerDiceWithinLimits(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerModifiedDice(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerRandom(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerAddNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerSubtractNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerMultiplyNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerModuloNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerDiceNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+	static int64_t* IntegerDiceWithinLimitsNumber(int64_t* top, const EvalOp& op, RollEngine* engine);
+
+	/* Add the currently parsed expression to the cache, replacing the
+	 * least recently used one if it is full. */
+	void CacheExpression(const char* expression);
 
- private:
-	ExpressionParser* EP;
+	/* Reads the next token from the current string being parsed into
+	 * CurrentToken. */
+	bool ReadToken();
+
+	/* Reads a dice modifier into CurrentToken, if there is one next in
+	 * the string, setting whether there was. */
+	bool ReadModifier(bool& matched);
+
+	/* Generate an error message highlighting the position of the error
+	 * in the expression, along with the passed message, and set it as
+	 * the roll's results. Returns false, for returning straight on. */
+	bool ParseError(const char* message);
 };
 
 
@@ -265,42 +591,144 @@ class RollEngine
 {
  friend class ExpressionParser;
 
+ /* The standalone benchmark suite in tools/ times the engine's internals
+  * directly. */
+ friend class RollBenchmark;
+
  public:
-	/* Constructor; initialises the seed, spawns the expression parser,
-	 * and initialise the constants. */
+	/* Constructor; seeds the generator, and spawns the expression
+	 * parser. */
 	RollEngine();
 
-	/* Destructor; delete the expression parser. */
-	~RollEngine() { delete expression; }
+	/* Destructor; delete the expression parser and the generator. */
+	~RollEngine() { delete expression; delete generator; }
 
-	/* Top-level function called to process a roll. */
+	/* Top-level function called to process a roll. Starts the generator
+	 * on the roll's sequence number, then performs the roll. */
 	void Run(const Roll& roll, RollResults& results);
 
+	/* Check a roll can run before it is queued, without performing it;
+	 * returns false after adding errors to results if it is a plain
+	 * expression which fails to parse. The checks roll no dice, and
+	 * allocate nothing for rolls which pass. Everything else is left to
+	 * Run() to report. */
+	bool Validate(const Roll& roll, RollResults& results);
+
+	/* Functions used to run a SIM-type roll in parts, so the trials may be
+	 * split across several engines; Run() simply calls all three in turn.
+	 * PrepareSimulation() starts the generator on the simulation's
+	 * sequence number and checks the simulation, filling trial with the
+	 * roll to perform and trials with how many times, and returns false
+	 * after adding errors to results if it cannot be run. Simulate() then
+	 * performs some number of trials, continuing the generator's current
+	 * stream, counting them in tally, and
+	 * ReportSimulation() adds the summary of the merged tallies to
+	 * results. */
+	bool PrepareSimulation(const Roll& roll, RollResults& results, Roll& trial, unsigned long& trials);
+	void Simulate(const Roll& trial, unsigned long trials, SimulationTally& tally);
+	void ReportSimulation(const Roll& roll, const SimulationTally& tally, RollResults& results);
+
+	/* Replace the random number generator used by this engine. The engine
+	 * takes ownership of the passed generator, and deletes the previous
+	 * one. By default, each engine uses its own XoshiroGenerator. */
+	void SetGenerator(RandomGenerator* gen);
+
+	/* Set the most expressions the engine keeps compiled for reuse; 0
+	 * disables the cache. By default, EXPRESSION_CACHE_SIZE are kept. */
+	void SetExpressionCacheCapacity(size_t capacity);
+
+	/* Get the number of expressions found in the cache, and that had to
+	 * be parsed, so far. */
+	void GetExpressionCacheStats(unsigned long& hits, unsigned long& misses) const;
+
  private:
 	
 	/* The expression parser instance used by RollEngine. */
 	ExpressionParser* expression;
 
 	/* Variables kept between rolls. */
-	unsigned int seed; /* Used as a running seed for ran(). */
+	RandomGenerator* generator; /* Source of all random numbers. */
 	double fuzzfactor; /* Used for the "joint" easter egg. */
 
+	/* Perform a roll, without starting the generator on a new stream;
+	 * used by Run(), and to run the trials of a simulation on the stream
+	 * of the simulation itself. */
+	void Perform(const Roll& roll, RollResults& results);
+
 	/* Variables set for each roll. */
 	const Roll* roll;
 	RollResults* results;
 
 	/* Variables used temporarily with different contents during processing
 	 * a roll. */
-	std::stringstream convstream;
+	char convbuffer[NUMBER_LENGTH];
 	std::string convstring;
 	std::string forstring;
+	std::string resultline;
 	unsigned int warning_count;
-
-	/* Handle ROLL-type rolls. */
+	std::vector<uint32_t> modifiedfaces;
+
+	/* The outcome of the roll, if it has a single numerical one; set by
+	 * RecordOutcome(), and used to tally simulations. */
+	bool outcome_recorded;
+	bool outcome_botched;
+	double outcome;
+
+	/* Whether the outcome is the value of a plain expression, still in
+	 * the parser, so simulations can evaluate more trials of it at once;
+	 * set by RollExpression(), if ReadExpression() parsed it. */
+	bool outcome_expression;
+	bool expression_parsed;
+
+	/* The most dice and steps the expressions evaluated by the roll could
+	 * take together, so simulations can limit the work of every trial;
+	 * added to by ReadExpression() and RollRepeatedExpression(). */
+	double expression_cost;
+
+	/* Whether roll data is added to the results; set by Run(), and
+	 * cleared for simulations, so their trials don't spend time on it. */
+	bool recording;
+
+	/* Whether the dice rolled by the trials of a batch are held, rather
+	 * than recorded straight away, so they can be recorded in trial order
+	 * once the batch is evaluated; set by RollRepeatedExpression(). The
+	 * batched RollTheBones() holds the dice of each trial it rolls for,
+	 * and RecordDice() those of holding_lane, set by the batch before
+	 * each trial's roll. Each roll held is its sides, its number of dice,
+	 * how many of its faces are held, and those faces; held_roll is the
+	 * offset of the latest roll held for each trial. */
+	bool holding;
+	size_t holding_lane;
+	std::vector<uint32_t> held_dice[EVAL_LANES];
+	size_t held_roll[EVAL_LANES];
+
+	/* Record the outcome of the current roll, and whether it botched. */
+	void RecordOutcome(double value, bool botched = false);
+
+	/* Record a roll of dice the engine rolled itself in the roll data. */
+	void RecordDice(const uint32_t* faces, size_t count, unsigned int sides);
+
+	/* Hold a roll of dice for a trial of a batch, and add faces to the
+	 * latest roll held for it, up to MAX_RESULT_VALUES values for the
+	 * trial, as the results would. RecordHeldDice() records the rolls
+	 * held for a trial in the roll data, and forgets them. */
+	void HoldDice(size_t lane, unsigned int sides, size_t count);
+	void HoldFaces(size_t lane, const uint32_t* faces, size_t count);
+	void RecordHeldDice(size_t lane);
+
+	/* Handle ROLL-type rolls. FindPreset() returns the function for the
+	 * preset roll named by the current roll, or NULL if it names none;
+	 * PresetID() returns the preset to record for such a function. */
+	typedef void (RollEngine::*PresetFunction)();
 	void DoRoll();
+	PresetFunction FindPreset();
+	RollPreset PresetID(PresetFunction function);
+	bool IsRepeatedExpression();
 	void RollCraps();
 	void RollD20();
 	void RollExalted(bool double_successes);
+	void RollExalted1E();
+	void RollExalted2E();
 	void RollNewHorizons();
 	void RollRTD();
 	void RollShadowrun();
@@ -334,9 +762,30 @@ class RollEngine
 	void ScoresDND7();
 	void ScoresNH();
 
-	/* Reads the given string as an expression, returning its numerical
-	 * value. Used for basic rolls, and for numerical parameters. */
-	double ReadExpression(const std::string& expression);
+	/* Handle ODDS-type rolls. */
+	void DoOdds();
+
+	/* Remembered distributions for rolls of a number of dice with a number
+	 * of sides, used by DiceDistribution(). */
+	std::map<std::pair<unsigned int, unsigned int>, Distribution> dicedistributions;
+
+	/* Return the exact distribution of a roll of the given dice, which
+	 * must already be within limits, or NULL after setting the error if
+	 * it has too many possible results. */
+	const Distribution* DiceDistribution(unsigned int count, unsigned int sides);
+
+	/* Clear the results and add the given error, returning false; used to
+	 * give up on calculating odds. */
+	bool OddsError(const std::string& message);
+
+	/* Handle SIM-type rolls. */
+	void DoSimulate();
+
+	/* Reads the given string as an expression, setting value to its
+	 * numerical value. Used for basic rolls, and for numerical parameters.
+	 * Returns false after setting the results to the errors if the
+	 * expression is invalid, in which case the roll should just return. */
+	bool ReadExpression(const std::string& expression, double& value);
 
 	/* Increment the warning count, and return true if another warning can
 	 * be added, or false if the maximum number of warnings has been
@@ -350,10 +799,11 @@ class RollEngine
 	 * result. */
 	const std::string& For();
 
-	/* Convert a number to a string. Uses convstring to avoid allocating a
-	 * string when called, and it and the other Str() must not be used twice
-	 * in the same line as a result. */
+	/* Convert a number to a string, to ten significant digits. Uses
+	 * convstring to avoid allocating a string when called, and it and the
+	 * other Str() must not be used twice in the same line as a result. */
 	const std::string& Str(double number);
+
 	
 	/* Convert a number corresponding to an evaluated input string, to a
 	 * string, adding the original input in brackets if they aren't
@@ -362,49 +812,121 @@ class RollEngine
 	 * as a result. */
 	const std::string& Str(double number, const std::string& input);
 
+	/* Converts a whole number to a string, exactly as Str() would, but
+	 * without going through a double for the numbers it writes out in
+	 * full. Shares Str()'s string, and its restrictions. */
+	const std::string& IntegerStr(int64_t number);
+
+	/* Result line building. A line is begun with BeginLine(), built up
+	 * with the Append functions, and then added to the results from
+	 * resultline. Its room is kept from line to line, so building one
+	 * allocates nothing unless it grows longer than any before it. Only
+	 * one line can be built at a time, and the Str() functions may be
+	 * used alongside. AppendNumber() writes numbers as Str() does, with
+	 * the input string after it in brackets if given and different;
+	 * AppendPadded() pads them with zeros on the left to at least width
+	 * characters; AppendFor() writes what For() returns; AppendMessage() writes the
+	 * parameters from first onwards, each after a space, as the optional
+	 * message to display with a roll. */
+	void BeginLine(const char* text);
+	void AppendText(const char* text);
+	void AppendText(const std::string& text);
+	void AppendNumber(double number);
+	void AppendNumber(double number, const std::string& input);
+	void AppendPadded(double number, unsigned int width);
+	void AppendInteger(int64_t number);
+	void AppendFor();
+	void AppendMessage(size_t first);
+
 	/* Roll functions; used to roll dice! */
 	/* RollTheBones may add warnings to the results if numbers exceeding
-	 * its limits are provided. */
+	 * its limits are provided. Given arrays, it rolls one dice roll for
+	 * each of lanes trials, replacing each count with the total.
+	 * RollTotal() rolls and totals dice without checking them. */
 	double RollTheBones(double count, double sides);
+	uint64_t RollTotal(size_t count, unsigned int sides);
+	void RollTheBones(double* counts, double* sides, size_t lanes);
 	unsigned int Random(unsigned int max);
 
+	/* Roll a dice roll from an expression with modifiers, adding any
+	 * warnings as RollTheBones does. Keeping and dropping dice only
+	 * partially sorts them, as far as needed to split them. */
+	double RollModifiedDice(double count, double sides, const ExpDiceModifiers& modifiers);
+
+	/* Roll the rest of an exploding die's chain, after it first came up
+	 * on its highest face. Returns how many more times in a row the die
+	 * came up highest, up to cap, and sets last to the face below the
+	 * highest which ended the chain, or to 0 if it reached the cap. Takes
+	 * the same time however long the chain. */
+	unsigned int RollExplosions(unsigned int sides, unsigned int cap, unsigned int& last);
+
+	/* Append an explosion chain from RollExplosions() to the line being
+	 * built, in the form "(10,10,3)". */
+	void AppendExplosionChain(unsigned int sides, unsigned int explosions, unsigned int last);
+
+	/* Applies RollTheBones' limits to a dice roll, adding its warnings to
+	 * the results if the passed count and sides must be changed. */
+	void CheckDice(double& count, double& sides);
+
+	/* Bulk dice functions; roll many dice of one size at once into a
+	 * buffer, and total such a buffer, using vectorised kernels where the
+	 * CPU supports them. RollDice performs no limit checks. */
+	void RollDice(uint32_t* faces, size_t count, unsigned int sides);
+	static uint64_t SumDice(const uint32_t* faces, size_t count);
+
+	/* Summary dice functions; these draw the counts of results directly,
+	 * so pools too large to show die by die take next to no time whatever
+	 * their size. Uniform() returns a random number strictly between 0
+	 * and 1. Binomial() returns how many of count trials with the given
+	 * chance succeed. RollFaceCounts() sets faces[n] to how many of count
+	 * dice with the given sides show n, for n from 1 to sides; faces must
+	 * have room for sides + 1 entries. */
+	double Uniform();
+	unsigned int Binomial(unsigned int count, double chance);
+	void RollFaceCounts(unsigned int* faces, unsigned int count, unsigned int sides);
+
+	/* Add a result line listing the face counts from RollFaceCounts(). */
+	void AddFaceCounts(const unsigned int* faces, unsigned int sides);
+
+	/* Add the "<Successes: n>" and "<BOTCHED ROLL! Botches: n>" result
+	 * lines ending pool rolls, given the number of successes; botches are
+	 * the successes below zero. */
+	void AddSuccesses(double successes);
+	void AddBotches(double successes);
+
 	/* Basic math functions, each taking and returning a double. These are
 	 * used in parsing expressions to implement support for the math
-	 * functions of the same name, and outside of this where required. */
+	 * functions of the same name, and outside of this where required.
+	 * All but ran(), which rolls a die, are static, so compiled expressions
+	 * call them through plain function pointers. */
 	/* See external helpop documentation for what each of these do. */
-	double deg(double);
-	double fac(double);
-	double rad(double);
+	static double deg(double);
+	static double fac(double);
+	static double rad(double);
 	double ran(double);
-	double sqr(double);
+	static double sqr(double);
 	
 	/* Basic math functions which are just wrappers around their C library
 	 * equivalents. */
 	/* See external helpop documentation for what each of these do. */
-	double abs(double);
-	double acos(double);
-	double asin(double);
-	double atan(double);
-	double ceil(double);
-	double cos(double);
-	double cosh(double);
-	double exp(double);
-	double floor(double);
-	double log(double);
-	double log10(double);
-	double round(double);
-	double sin(double);
-	double sinh(double);
-	double sqrt(double);
-	double tan(double);
-	double tanh(double);
-	double trunc(double);
-
-	/* Constant map, to which supported constants are added. */
-	std::map<const char*, double, TextTokenCompare> constants;
-
-	/* Function map, containing mathematical functions. */
-	std::map<const char*, double(RollEngine::*)(double), TextTokenCompare> functions;
+	static double abs(double);
+	static double acos(double);
+	static double asin(double);
+	static double atan(double);
+	static double ceil(double);
+	static double cos(double);
+	static double cosh(double);
+	static double exp(double);
+	static double floor(double);
+	static double log(double);
+	static double log10(double);
+	static double round(double);
+	static double sin(double);
+	static double sinh(double);
+	static double sqrt(double);
+	static double tan(double);
+	static double tanh(double);
+	static double trunc(double);
 };
 
 #endif
@@ -0,0 +1,252 @@
+/* RollEngine random number generators. */
+#include "rollrandom.h"
+
+
+
+/* SplitMix64, used to expand a single 64-bit seed into generator state. As
+ * recommended by the xoshiro authors, this guarantees no all-zero state. */
+static uint64_t SplitMix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+
+static inline uint64_t RotateLeft(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+
+void XoshiroGenerator::Seed(uint64_t seed)
+{
+	for (unsigned int i = 0; i < 4; i++)
+		state[i] = SplitMix64(seed);
+	for (unsigned int lane = 0; lane < XOSHIRO_LANES; lane++)
+		for (unsigned int i = 0; i < 4; i++)
+			lanes[i][lane] = SplitMix64(seed);
+}
+
+
+
+uint64_t XoshiroGenerator::Next()
+{
+	uint64_t result = RotateLeft(state[1] * 5, 7) * 9;
+	uint64_t t = state[1] << 17;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+
+	state[2] ^= t;
+	state[3] = RotateLeft(state[3], 45);
+
+	return result;
+}
+
+
+
+/* This is the same step as Next(), applied to every lane at once. The lanes
+ * are kept in separate arrays per state word so the inner loops vectorise. */
+void XoshiroGenerator::Fill(uint64_t* words, size_t count)
+{
+	uint64_t result[XOSHIRO_LANES];
+	uint64_t t[XOSHIRO_LANES];
+	size_t i = 0;
+
+	while (i < count)
+	{
+		for (unsigned int lane = 0; lane < XOSHIRO_LANES; lane++)
+		{
+			result[lane] = RotateLeft(lanes[1][lane] * 5, 7) * 9;
+			t[lane] = lanes[1][lane] << 17;
+
+			lanes[2][lane] ^= lanes[0][lane];
+			lanes[3][lane] ^= lanes[1][lane];
+			lanes[1][lane] ^= lanes[2][lane];
+			lanes[0][lane] ^= lanes[3][lane];
+
+			lanes[2][lane] ^= t[lane];
+			lanes[3][lane] = RotateLeft(lanes[3][lane], 45);
+		}
+
+		for (unsigned int lane = 0; lane < XOSHIRO_LANES && i < count; lane++, i++)
+			words[i] = result[lane];
+	}
+}
+
+
+
+/* The jump polynomial is applied to the main state and every bulk lane, so
+ * none of a jumped copy's output overlaps with the original's. */
+void XoshiroGenerator::Jump()
+{
+	static const uint64_t polynomial[4] = { 0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL };
+
+	uint64_t jumped[4] = { 0, 0, 0, 0 };
+	uint64_t jumpedlanes[4][XOSHIRO_LANES];
+	uint64_t words[XOSHIRO_LANES];
+	for (unsigned int i = 0; i < 4; i++)
+		for (unsigned int lane = 0; lane < XOSHIRO_LANES; lane++)
+			jumpedlanes[i][lane] = 0;
+
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		for (unsigned int bit = 0; bit < 64; bit++)
+		{
+			if (polynomial[i] & (1ULL << bit))
+			{
+				for (unsigned int j = 0; j < 4; j++)
+				{
+					jumped[j] ^= state[j];
+					for (unsigned int lane = 0; lane < XOSHIRO_LANES; lane++)
+						jumpedlanes[j][lane] ^= lanes[j][lane];
+				}
+			}
+			Next();
+			Fill(words, XOSHIRO_LANES);
+		}
+	}
+
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		state[i] = jumped[i];
+		for (unsigned int lane = 0; lane < XOSHIRO_LANES; lane++)
+			lanes[i][lane] = jumpedlanes[i][lane];
+	}
+}
+
+
+
+/* FNV-1a over the secret, with the result passed through SplitMix64 so that
+ * similar secrets give unrelated keys. */
+uint64_t PhiloxGenerator::KeyFromSecret(const std::string& secret)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < secret.size(); i++)
+	{
+		hash ^= (unsigned char)secret[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return SplitMix64(hash);
+}
+
+
+
+void PhiloxGenerator::Seed(uint64_t seed)
+{
+	key[0] = (uint32_t)seed;
+	key[1] = (uint32_t)(seed >> 32);
+	BeginRoll(0);
+}
+
+
+
+void PhiloxGenerator::BeginRoll(uint64_t sequence)
+{
+	counter[0] = 0;
+	counter[1] = 0;
+	counter[2] = (uint32_t)sequence;
+	counter[3] = (uint32_t)(sequence >> 32);
+	spared = false;
+}
+
+
+
+void PhiloxGenerator::SetSubstream(uint32_t substream)
+{
+	counter[0] = 0;
+	counter[1] = substream;
+	spared = false;
+}
+
+
+
+/* Ten rounds of the Philox S-box; each multiplies two counter words by fixed
+ * constants, and mixes the high halves of the products with the other words
+ * and the key, which is bumped by the Weyl sequence constants each round. */
+void PhiloxGenerator::Block(uint64_t* words)
+{
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (unsigned int round = 0; round < 10; round++)
+	{
+		uint64_t product0 = (uint64_t)0xD2511F53 * c0;
+		uint64_t product1 = (uint64_t)0xCD9E8D57 * c2;
+
+		c0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t)product1;
+		c2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t)product0;
+
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+
+	words[0] = ((uint64_t)c1 << 32) | c0;
+	words[1] = ((uint64_t)c3 << 32) | c2;
+
+	/* The block number is the low 32 bits; the substream is never
+	 * carried into. */
+	counter[0]++;
+}
+
+
+
+uint64_t PhiloxGenerator::Next()
+{
+	if (spared)
+	{
+		spared = false;
+		return spare;
+	}
+
+	uint64_t words[2];
+	Block(words);
+	spare = words[1];
+	spared = true;
+	return words[0];
+}
+
+
+
+void PhiloxGenerator::Fill(uint64_t* words, size_t count)
+{
+	size_t i = 0;
+	if (spared && count)
+	{
+		words[i++] = spare;
+		spared = false;
+	}
+
+	for (; i + 2 <= count; i += 2)
+		Block(words + i);
+
+	if (i < count)
+		words[i] = Next();
+}
+
+
+
+void LibcGenerator::Seed(uint64_t seed)
+{
+	state = (unsigned int)(seed ^ (seed >> 32));
+}
+
+
+
+/* rand_r() only provides 31 bits per call, so three calls are combined to
+ * fill the 64-bit word. */
+uint64_t LibcGenerator::Next()
+{
+	uint64_t result = 0;
+	for (unsigned int i = 0; i < 3; i++)
+		result = (result << 31) ^ (uint64_t)rand_r(&state);
+	return result;
+}
@@ -0,0 +1,143 @@
+/* RollEngine random number generator header file. */
+#ifndef __ROLLRANDOM_H__
+#define __ROLLRANDOM_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+
+
+/* RandomGenerator is the source of randomness used by RollEngine. Each engine
+ * owns exactly one generator, which may be replaced at any time between rolls
+ * with SetGenerator(). Generators only need to provide raw 64-bit random
+ * words; RollEngine handles mapping these to die faces without bias.
+ *
+ * Generators are either running generators, continuing one stream from roll
+ * to roll, or stream-per-roll generators, which start every roll on a stream
+ * of its own picked by the roll's sequence number.
+ *
+ * Generators are not thread safe, and must not be shared between engines. */
+class RandomGenerator
+{
+ public:
+	virtual ~RandomGenerator() { }
+
+	/* Reset the generator's state from the given seed. Any seed, including
+	 * zero, must be accepted. */
+	virtual void Seed(uint64_t seed) = 0;
+
+	/* Called by RollEngine at the start of each roll with the roll's
+	 * sequence number. Stream-per-roll generators restart on the stream
+	 * for that number; running generators ignore it. */
+	virtual void BeginRoll(uint64_t /*sequence*/) { }
+
+	/* Return the next 64 random bits from the generator. */
+	virtual uint64_t Next() = 0;
+
+	/* Fill the passed buffer with count random 64-bit words. Generators
+	 * should override this where they can produce words in bulk faster
+	 * than through repeated Next() calls. */
+	virtual void Fill(uint64_t* words, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			words[i] = Next();
+	}
+};
+
+
+
+/* Number of interleaved lanes XoshiroGenerator runs for bulk output. */
+#define XOSHIRO_LANES 4
+
+/* xoshiro256** generator, by David Blackman and Sebastiano Vigna. This is
+ * the default generator; it is fast, has 256 bits of state, and passes all
+ * the usual statistical test suites.
+ *
+ * Bulk output from Fill() comes from XOSHIRO_LANES further, independently
+ * seeded generators stepped side by side, which the compiler can keep in
+ * vector registers. */
+class XoshiroGenerator : public RandomGenerator
+{
+ public:
+	XoshiroGenerator(uint64_t seed) { Seed(seed); }
+
+	void Seed(uint64_t seed);
+	uint64_t Next();
+	void Fill(uint64_t* words, size_t count);
+
+	/* Advance the generator by 2^128 steps. A copy of a generator which is
+	 * then jumped produces a stream which will never overlap the
+	 * original's in practice; used to give parallel engines independent
+	 * streams. */
+	void Jump();
+
+ private:
+	uint64_t state[4];
+	uint64_t lanes[4][XOSHIRO_LANES];
+};
+
+
+
+/* Philox4x32-10 counter-based generator, by Salmon et al. (Random123). Each
+ * block of output is a keyed bijection of a 128-bit counter, so any point in
+ * any stream can be computed directly, with no state carried from earlier
+ * output.
+ *
+ * This is a stream-per-roll generator. The counter holds the roll's sequence
+ * number in its upper half, a substream number, and the block within the
+ * substream. Given the same key, a roll with the same sequence number always
+ * gets the same random numbers, whichever engine or thread runs it; this
+ * allows rolls to be replayed exactly, and spread across threads without
+ * sharing any generator state. */
+class PhiloxGenerator : public RandomGenerator
+{
+ public:
+	PhiloxGenerator(uint64_t key) { Seed(key); }
+
+	/* Derive a generator key from a secret of any length. */
+	static uint64_t KeyFromSecret(const std::string& secret);
+
+	/* Set the key, and restart on the stream for sequence number zero. */
+	void Seed(uint64_t key);
+
+	void BeginRoll(uint64_t sequence);
+	uint64_t Next();
+	void Fill(uint64_t* words, size_t count);
+
+	/* Move to the start of another substream of the current roll's stream.
+	 * Substream zero is the one used by the roll itself; others may be
+	 * given to threads helping with the roll. */
+	void SetSubstream(uint32_t substream);
+
+ private:
+	uint32_t key[2];
+	uint32_t counter[4];
+
+	/* The second word of the last block, if not yet used. */
+	uint64_t spare;
+	bool spared;
+
+	/* Produce the block for the current counter into words, and advance
+	 * the counter. */
+	void Block(uint64_t* words);
+};
+
+
+
+/* Generator wrapping the C library's rand_r(), as used by RollEngine before
+ * pluggable generators were added. Slow, and with a tiny state; provided for
+ * comparison and compatibility only. */
+class LibcGenerator : public RandomGenerator
+{
+ public:
+	LibcGenerator(uint64_t seed) { Seed(seed); }
+
+	void Seed(uint64_t seed);
+	uint64_t Next();
+
+ private:
+	unsigned int state;
+};
+
+#endif
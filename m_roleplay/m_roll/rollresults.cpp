@@ -5,78 +5,180 @@
 
 void RollResults::AddError(const std::string& msg)
 {
-	types.push_back(ERR);
-	data.push_back(msg);
+	AddLine(ERR, msg.data(), msg.size(), "", 0);
 }
 
 
 
 void RollResults::AddMsg(const std::string& msg)
 {
-	types.push_back(MESSAGE);
-	data.push_back(msg);
+	AddLine(MESSAGE, msg.data(), msg.size(), "", 0);
 }
 
 
 
 void RollResults::AddAction(const std::string& action)
 {
-	types.push_back(ACTION);
-	data.push_back(action);
+	AddLine(ACTION, action.data(), action.size(), "", 0);
 }
 
 
 
 void RollResults::AddNPC(const std::string& npc, const std::string& msg)
 {
-	types.push_back(NPC);
-	data.push_back(npc);
-	data.push_back(msg);
+	AddLine(NPC, msg.data(), msg.size(), npc.data(), npc.size());
 }
 
 
 
 void RollResults::AddNPCA(const std::string& npc, const std::string& action)
 {
-	types.push_back(NPCA);
-	data.push_back(npc);
-	data.push_back(action);
+	AddLine(NPCA, action.data(), action.size(), npc.data(), npc.size());
 }
 
 
 
 void RollResults::AddScene(const std::string& msg)
 {
-	types.push_back(SCENE);
-	data.push_back(msg);
+	AddLine(SCENE, msg.data(), msg.size(), "", 0);
 }
 
 
 
 void RollResults::AddKick(const std::string& reason)
 {
-	types.push_back(KICK);
-	data.push_back(reason);
+	AddLine(KICK, reason.data(), reason.size(), "", 0);
 }
 
 
 
 void RollResults::AddShun(const std::string& reason, const int& duration)
 {
-	types.push_back(SHUN);
-	data.push_back(reason);
+	char durationstring[NUMBER_LENGTH];
+	size_t length = FormatInteger(durationstring, duration);
+	AddLine(SHUN, reason.data(), reason.size(), durationstring, length);
+}
+
+
+
+void RollResults::AddExpression(const std::string& expression, double value)
+{
+	*AddData(DATA_EXPRESSION, expression.data(), expression.size(), 1) = value;
+}
+
+
+
+/* The dice count is kept separately from the faces, so it stays right when
+ * faces are left out. */
+void RollResults::AddDice(unsigned int sides, size_t count)
+{
+	double* dice = AddData(DATA_DICE, "", 0, 2);
+	dice[0] = sides;
+	dice[1] = count;
+}
+
+
+
+void RollResults::AddFaces(const uint32_t* faces, size_t count)
+{
+	if (values.size() >= MAX_RESULT_VALUES)
+		return;
+	count = std::min(count, MAX_RESULT_VALUES - values.size());
+
+	values.insert(values.end(), faces, faces + count);
+	data.back().count += count;
+}
+
+
+
+void RollResults::AddFaceCounts(const unsigned int* faces, unsigned int sides)
+{
+	double* counts = AddData(DATA_FACE_COUNTS, "", 0, sides + 1);
+	counts[0] = sides;
+	std::copy(faces + 1, faces + sides + 1, counts + 1);
+}
+
+
+
+void RollResults::AddSuccesses(double successes)
+{
+	*AddData(DATA_SUCCESSES, "", 0, 1) = successes;
+}
+
+
 
-	std::stringstream convstream;
-	std::string durationstring;
-	convstream << duration;
-	convstream >> durationstring;
-	data.push_back(durationstring);
+void RollResults::AddBotches(double botches)
+{
+	*AddData(DATA_BOTCHES, "", 0, 1) = botches;
+}
+
+
+
+void RollResults::AddOutcome(double outcome, bool botched)
+{
+	double* item = AddData(DATA_OUTCOME, "", 0, 2);
+	item[0] = outcome;
+	item[1] = botched;
 }
 
 
 
 void RollResults::Clear()
 {
-	types.clear();
+	/* Keep the room made, for any lines added after. */
+	lines.clear();
+	buffer.clear();
 	data.clear();
+	values.clear();
+}
+
+
+
+void RollResults::AddLine(RollResultType type, const char* text, size_t text_length, const char* extra, size_t extra_length)
+{
+	if (lines.capacity() == 0)
+	{
+		lines.reserve(RESULT_LINES);
+		buffer.reserve(RESULT_TEXT);
+	}
+
+	RollResultLine line;
+	line.type = type;
+	line.text = AddText(text, text_length);
+	line.text_length = text_length;
+	line.extra = AddText(extra, extra_length);
+	line.extra_length = extra_length;
+	lines.push_back(line);
+}
+
+
+
+uint32_t RollResults::AddText(const char* text, size_t length)
+{
+	uint32_t offset = buffer.size();
+	buffer.insert(buffer.end(), text, text + length);
+	buffer.push_back('\0');
+	return offset;
+}
+
+
+
+double* RollResults::AddData(RollDataType type, const char* text, size_t text_length, size_t count)
+{
+	if (data.capacity() == 0)
+	{
+		data.reserve(RESULT_DATA);
+		values.reserve(RESULT_VALUES);
+	}
+
+	RollDataItem item;
+	item.type = type;
+	item.text = AddText(text, text_length);
+	item.text_length = text_length;
+	item.first = values.size();
+	item.count = count;
+	data.push_back(item);
+
+	values.resize(values.size() + count);
+	return &values[item.first];
 }
@@ -0,0 +1,355 @@
+/* Microbenchmark suite for RollEngine.
+ *
+ * Times the expression parser, number formatting, dice rolling, and every
+ * preset roll through RollEngine::Run(), reporting the time, heap allocations
+ * and bytes allocated per operation. Changes to the dice path should be
+ * judged against these numbers.
+ *
+ * Each case is run in doubling batches until a batch takes at least the
+ * minimum time, and that batch is reported. Cases whose names contain none
+ * of the filters given on the command line are skipped. */
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "rollengine.h"
+
+
+
+/* GCC can't tell the replacement operator delete frees what the replacement
+ * operator new allocated. */
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+/* Heap allocations counted by the replacement operator new. */
+static unsigned long long allocations = 0;
+static unsigned long long allocated_bytes = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	allocations++;
+	allocated_bytes += size;
+	void* memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) throw()
+{
+	free(memory);
+}
+
+void operator delete[](void* memory) throw()
+{
+	free(memory);
+}
+
+
+
+static double Now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+
+/* Has access to RollEngine's internals, and holds the engine and roll state
+ * the cases run against. */
+class RollBenchmark
+{
+ public:
+	RollBenchmark();
+
+	/* Benchmark cases. Each performs one operation, with the argument
+	 * from its entry in the case table. */
+	void Parse(const char* expression);
+	void ParseCached(const char* expression);
+	void Eval(const char* expression);
+	void EvalBatch(const char* expression);
+	void StrNumber(const char* number);
+	void StrInput(const char* input);
+	void RollTheBones(const char* dice);
+	void Run(const char* roll);
+	void Scores(const char* scores);
+	void Simulate(const char* simulation);
+
+	/* Set up for a case, outside of the timing. */
+	void Prepare(const char* argument);
+
+ private:
+	RollEngine RE;
+	ExpressionParser parser;
+	Roll roll;
+	RollResults results;
+
+	/* Arguments pre-converted by Prepare(). */
+	double number;
+	double count;
+	double sides;
+	std::string input;
+	Roll preset;
+	double values[EVAL_LANES];
+};
+
+/* Benchmark case table. */
+struct BenchmarkCase
+{
+	const char* name;
+	void (RollBenchmark::*function)(const char*);
+	const char* argument;
+};
+
+static const BenchmarkCase cases[] = {
+	{ "Parse/short", &RollBenchmark::Parse, "1d20+5" },
+	{ "Parse/long", &RollBenchmark::Parse, "(4d6+3)*2-1d8/2+sqr(16)^2-abs(-3)%4+floor(2.5*pi)+ceil(2.1)-(2d10+1d4+5)*(3-1)" },
+	{ "Parse/cached", &RollBenchmark::ParseCached, "1d20+5" },
+	{ "Eval/short", &RollBenchmark::Eval, "1d20+5" },
+	{ "Eval/long", &RollBenchmark::Eval, "(4d6+3)*2-1d8/2+sqr(16)^2-abs(-3)%4+floor(2.5*pi)+ceil(2.1)-(2d10+1d4+5)*(3-1)" },
+	{ "Eval/integer", &RollBenchmark::Eval, "(4d6+3)*2-1d8%3+abs(-3)%4*ran(6)-(2d10+1d4+5)*(3-1)" },
+	{ "EvalBatch/short", &RollBenchmark::EvalBatch, "1d20+5" },
+	{ "EvalBatch/long", &RollBenchmark::EvalBatch, "(4d6+3)*2-1d8/2+sqr(16)^2-abs(-3)%4+floor(2.5*pi)+ceil(2.1)-(2d10+1d4+5)*(3-1)" },
+	{ "Str/integer", &RollBenchmark::StrNumber, "17" },
+	{ "Str/fraction", &RollBenchmark::StrNumber, "3.14159" },
+	{ "Str/input-same", &RollBenchmark::StrInput, "17" },
+	{ "Str/input-differs", &RollBenchmark::StrInput, "2d6+5" },
+	{ "RollTheBones/1d20", &RollBenchmark::RollTheBones, "1 20" },
+	{ "RollTheBones/3d6", &RollBenchmark::RollTheBones, "3 6" },
+	{ "RollTheBones/10d10", &RollBenchmark::RollTheBones, "10 10" },
+	{ "RollTheBones/100d6", &RollBenchmark::RollTheBones, "100 6" },
+	{ "RollTheBones/10000d6", &RollBenchmark::RollTheBones, "10000 6" },
+	{ "RollTheBones/100d10000", &RollBenchmark::RollTheBones, "100 10000" },
+	{ "Run/Craps", &RollBenchmark::Run, "craps" },
+	{ "Run/D20", &RollBenchmark::Run, "dt 5 15" },
+	{ "Run/Exalted", &RollBenchmark::Run, "exalted 10" },
+	{ "Run/Exalted2", &RollBenchmark::Run, "exalted2 10" },
+	{ "Run/Exalted-pool", &RollBenchmark::Run, "exalted 40" },
+	{ "Run/Exalted-summary", &RollBenchmark::Run, "exalted 1000" },
+	{ "Run/NewHorizons", &RollBenchmark::Run, "nh 10" },
+	{ "Run/RTD", &RollBenchmark::Run, "rtd" },
+	{ "Run/Shadowrun", &RollBenchmark::Run, "shadowrun 6 5" },
+	{ "Run/WOD", &RollBenchmark::Run, "wod 6 6" },
+	{ "Run/RWOD", &RollBenchmark::Run, "rwod 6 6" },
+	{ "Run/NWOD", &RollBenchmark::Run, "nwod 6" },
+	{ "Run/NWODChance", &RollBenchmark::Run, "nwodc" },
+	{ "Run/DND2EInit", &RollBenchmark::Run, "init 3" },
+	{ "Run/DNDAlias", &RollBenchmark::Run, "attack 5" },
+	{ "Run/EEBarrel", &RollBenchmark::Run, "barrel" },
+	{ "Run/EEDownTheStairs", &RollBenchmark::Run, "down the stairs" },
+	{ "Run/EEInTheHay", &RollBenchmark::Run, "in the hay" },
+	{ "Run/EEJoint", &RollBenchmark::Run, "joint" },
+	{ "Run/EEJointFuzzFactor", &RollBenchmark::Run, "fuzzfactor" },
+	{ "Run/EEOver", &RollBenchmark::Run, "over" },
+	{ "Run/EERick", &RollBenchmark::Run, "rick" },
+	{ "Run/EEYourMom", &RollBenchmark::Run, "your mom" },
+	{ "Run/EEYourDad", &RollBenchmark::Run, "your dad" },
+	{ "Run/RepeatedExpression", &RollBenchmark::Run, "6[4d6]" },
+	{ "Run/Expression", &RollBenchmark::Run, "1d20+5" },
+	{ "Run/ParseError", &RollBenchmark::Run, "1d20+" },
+	{ "Scores/DND1", &RollBenchmark::Scores, "dnd 1" },
+	{ "Scores/DND2", &RollBenchmark::Scores, "dnd 2" },
+	{ "Scores/DND3", &RollBenchmark::Scores, "dnd 3" },
+	{ "Scores/DND4", &RollBenchmark::Scores, "dnd 4" },
+	{ "Scores/DND5", &RollBenchmark::Scores, "dnd 5" },
+	{ "Scores/DND6", &RollBenchmark::Scores, "dnd 6" },
+	{ "Scores/DND7", &RollBenchmark::Scores, "dnd 7" },
+	{ "Scores/NH", &RollBenchmark::Scores, "nh" },
+	{ "Sim/Expression", &RollBenchmark::Simulate, "1000 3d6+2" },
+	{ "Sim/WOD", &RollBenchmark::Simulate, "1000 wod 6 6" },
+};
+
+
+
+/* The benchmark engine rolls as IRC_CHAN, so the easter eggs run. The
+ * parser of its own has no cache, so the parse cases time parsing itself. */
+RollBenchmark::RollBenchmark() : parser(&RE)
+{
+	parser.SetCacheCapacity(0);
+	roll.type = CALC;
+	roll.outputtype = IRC_CHAN;
+	roll.extra.push_back("bench");
+	roll.extra.push_back("#bench");
+	RE.roll = &roll;
+	RE.results = &results;
+}
+
+
+
+void RollBenchmark::Prepare(const char* argument)
+{
+	number = strtod(argument, NULL);
+	sscanf(argument, "%lf %lf", &count, &sides);
+	input = argument;
+
+	/* Split the roll for Run() and Scores() into parameters once. */
+	preset = roll;
+	preset.expression.clear();
+	std::istringstream words(argument);
+	std::string word;
+	while (words >> word)
+		preset.expression.push_back(word);
+
+	/* Eval() needs the expression parsed beforehand. */
+	parser.Parse(argument);
+}
+
+
+
+void RollBenchmark::Parse(const char* expression)
+{
+	parser.Parse(expression);
+}
+
+
+
+void RollBenchmark::ParseCached(const char* expression)
+{
+	RE.expression->Parse(expression);
+}
+
+
+
+void RollBenchmark::Eval(const char*)
+{
+	parser.Eval();
+}
+
+
+
+/* Evaluates EVAL_LANES trials per operation. */
+void RollBenchmark::EvalBatch(const char*)
+{
+	parser.EvalBatch(EVAL_LANES, values);
+}
+
+
+
+void RollBenchmark::StrNumber(const char*)
+{
+	RE.Str(number);
+}
+
+
+
+void RollBenchmark::StrInput(const char*)
+{
+	RE.Str(17, input);
+}
+
+
+
+void RollBenchmark::RollTheBones(const char*)
+{
+	RE.RollTheBones(count, sides);
+}
+
+
+
+void RollBenchmark::Run(const char*)
+{
+	preset.type = ROLL;
+	results.Clear();
+	RE.Run(preset, results);
+}
+
+
+
+void RollBenchmark::Scores(const char*)
+{
+	preset.type = SCORES;
+	results.Clear();
+	RE.Run(preset, results);
+}
+
+
+
+void RollBenchmark::Simulate(const char*)
+{
+	preset.type = SIM;
+	results.Clear();
+	RE.Run(preset, results);
+}
+
+
+
+/* Run a case, printing its results. */
+static void RunCase(RollBenchmark& bench, const BenchmarkCase& benchcase, double min_time)
+{
+	bench.Prepare(benchcase.argument);
+
+	unsigned long iterations = 1;
+	double elapsed;
+	unsigned long long batch_allocations, batch_bytes;
+	while (1)
+	{
+		unsigned long long start_allocations = allocations;
+		unsigned long long start_bytes = allocated_bytes;
+		double start = Now();
+		for (unsigned long i = 0; i < iterations; i++)
+			(bench.*benchcase.function)(benchcase.argument);
+		elapsed = Now() - start;
+		batch_allocations = allocations - start_allocations;
+		batch_bytes = allocated_bytes - start_bytes;
+
+		if (elapsed >= min_time || iterations >= 1UL << 30)
+			break;
+		iterations *= 2;
+	}
+
+	printf("%-26s %12lu %12.1f ns/op %10.2f allocs/op %12.1f B/op\n", benchcase.name, iterations,
+		elapsed * 1e9 / iterations, (double)batch_allocations / iterations, (double)batch_bytes / iterations);
+}
+
+
+
+static void Usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-t milliseconds] [filter ...]\n", name);
+	fprintf(stderr, "  -t milliseconds  Minimum time to run each case for; default 200.\n");
+	fprintf(stderr, "  filter           Only run cases whose names contain one of these.\n");
+}
+
+
+
+int main(int argc, char** argv)
+{
+	double min_time = 0.2;
+	int option;
+	while ((option = getopt(argc, argv, "t:h")) != -1)
+	{
+		switch (option)
+		{
+			case 't':
+				min_time = strtod(optarg, NULL) / 1000;
+				break;
+			default:
+				Usage(argv[0]);
+				return option == 'h' ? 0 : 1;
+		}
+	}
+
+	RollBenchmark bench;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		bool selected = optind == argc;
+		for (int filter = optind; filter < argc; filter++)
+		{
+			if (strstr(cases[i].name, argv[filter]))
+				selected = true;
+		}
+
+		if (selected)
+			RunCase(bench, cases[i], min_time);
+	}
+	return 0;
+}
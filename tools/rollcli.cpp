@@ -0,0 +1,311 @@
+/* Command line driver for RollEngine, used to run, replay and time rolls
+ * outside of InspIRCd.
+ *
+ * Reads rolls from the files given, or stdin, one per line, and prints their
+ * results. Each line is an optional roll type (CALC, ROLL, SCORES, ODDS or
+ * SIM; ROLL if omitted) followed by the roll's parameters, split on spaces,
+ * as they would be given to /ROLL or /SCORES. Blank lines and lines starting
+ * with # are skipped. */
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "rollengine.h"
+
+
+
+/* Options set on the command line. */
+static const char* nick = NULL;  /* Roll as IRC_CHAN for this nick. */
+static const char* secret = NULL; /* Use a PhiloxGenerator with this secret. */
+static uint64_t sequence = 0;    /* Sequence number of the next roll. */
+static unsigned long repeats = 1; /* Times to perform each roll. */
+static bool quiet = false;       /* Don't print results. */
+static bool showdata = false;    /* Print roll data after the results. */
+static bool timing = false;      /* Print timings to stderr at the end. */
+static bool checkfaces = false;  /* Check recorded faces add up to results. */
+static long cachesize = EXPRESSION_CACHE_SIZE; /* Expression cache capacity. */
+
+/* Latency of every roll performed, in seconds, for the timings. */
+static std::vector<double> latencies;
+
+/* Expressions whose recorded faces didn't add up to their results. */
+static unsigned long mismatches = 0;
+
+static const char* typenames[] = { "ERR", "MSG", "ACTION", "NPC", "NPCA", "SCENE", "KICK", "SHUN" };
+static const char* datanames[] = { "EXPRESSION", "DICE", "FACECOUNTS", "SUCCESSES", "BOTCHES", "OUTCOME" };
+static const char* presetnames[] = { "NONE", "EXPRESSION", "REPEATED", "CRAPS", "D20", "EXALTED", "EXALTED2",
+	"NEWHORIZONS", "RTD", "SHADOWRUN", "WOD", "RWOD", "NWOD", "NWODCHANCE", "DND2EINIT", "DNDALIAS", "EASTEREGG",
+	"SCORES", "ODDS", "SIM" };
+
+
+
+static double Now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+
+/* Print a set of results, one line per result. */
+static void PrintResults(const RollResults& results)
+{
+	for (size_t i = 0; i < results.lines.size(); i++)
+	{
+		/* NPC lines and NPC actions are shown after the NPC's name, and
+		 * shuns before their duration. */
+		const RollResultLine& line = results.lines[i];
+		if (line.type == NPC || line.type == NPCA)
+			printf("%s: %s | %s\n", typenames[line.type], results.Extra(line), results.Text(line));
+		else if (line.type == SHUN)
+			printf("%s: %s | %s\n", typenames[line.type], results.Text(line), results.Extra(line));
+		else
+			printf("%s: %s\n", typenames[line.type], results.Text(line));
+	}
+}
+
+
+
+/* Print the preset and roll data of a set of results, one line per item, with
+ * any text before the values. */
+static void PrintData(const RollResults& results)
+{
+	printf("PRESET: %s\n", presetnames[results.preset]);
+	for (size_t i = 0; i < results.data.size(); i++)
+	{
+		const RollDataItem& item = results.data[i];
+		printf("%s:", datanames[item.type]);
+		if (item.text_length)
+			printf(" %s |", results.Text(item));
+
+		const double* values = results.Values(item);
+		for (uint32_t value = 0; value < item.count; value++)
+			printf(" %.10g", values[value]);
+		printf("\n");
+	}
+}
+
+
+
+/* Check that the faces recorded for each expression add up to its result, as
+ * they do for expressions which only add up dice, printing any which don't to
+ * stderr. Expressions rolling no dice, or with faces left out, are skipped. */
+static void CheckFaces(const RollResults& results)
+{
+	double total = 0;
+	bool rolled = false;
+	bool complete = true;
+	for (size_t i = 0; i < results.data.size(); i++)
+	{
+		const RollDataItem& item = results.data[i];
+		const double* values = results.Values(item);
+		if (item.type == DATA_DICE)
+		{
+			rolled = true;
+			complete = complete && item.count == values[1] + 2;
+			for (uint32_t value = 2; value < item.count; value++)
+				total += values[value];
+		}
+		else if (item.type == DATA_EXPRESSION)
+		{
+			if (rolled && complete && total != values[0])
+			{
+				fprintf(stderr, "Faces of %s add up to %.10g, not %.10g.\n", results.Text(item), total, values[0]);
+				mismatches++;
+			}
+			total = 0;
+			rolled = false;
+			complete = true;
+		}
+	}
+}
+
+
+
+/* Parse and perform one line of input. */
+static void RunLine(RollEngine& RE, const std::string& line)
+{
+	Roll roll;
+	roll.type = ROLL;
+	roll.outputtype = PLAIN;
+	if (nick)
+	{
+		roll.outputtype = IRC_CHAN;
+		roll.extra.push_back(nick);
+		roll.extra.push_back("#rollcli");
+	}
+
+	std::istringstream words(line);
+	std::string word;
+	while (words >> word)
+	{
+		if (roll.expression.empty())
+		{
+			if (!strcasecmp(word.c_str(), "CALC"))
+				roll.type = CALC;
+			else if (!strcasecmp(word.c_str(), "ROLL"))
+				roll.type = ROLL;
+			else if (!strcasecmp(word.c_str(), "SCORES"))
+				roll.type = SCORES;
+			else if (!strcasecmp(word.c_str(), "ODDS"))
+				roll.type = ODDS;
+			else if (!strcasecmp(word.c_str(), "SIM"))
+				roll.type = SIM;
+			else
+				roll.expression.push_back(word);
+		}
+		else
+			roll.expression.push_back(word);
+	}
+
+	if (roll.expression.empty() || roll.expression[0][0] == '#')
+		return;
+
+	RollResults results;
+	for (unsigned long i = 0; i < repeats; i++)
+	{
+		results.Clear();
+		roll.sequence = sequence++;
+
+		double start = Now();
+		RE.Run(roll, results);
+		latencies.push_back(Now() - start);
+		if (checkfaces)
+			CheckFaces(results);
+	}
+
+	if (!quiet)
+		PrintResults(results);
+	if (!quiet && showdata)
+		PrintData(results);
+}
+
+
+
+static void RunStream(RollEngine& RE, std::istream& input)
+{
+	std::string line;
+	while (std::getline(input, line))
+		RunLine(RE, line);
+}
+
+
+
+static void PrintTimings(double elapsed)
+{
+	if (latencies.empty())
+		return;
+
+	std::sort(latencies.begin(), latencies.end());
+	double total = 0;
+	for (size_t i = 0; i < latencies.size(); i++)
+		total += latencies[i];
+
+	fprintf(stderr, "%lu rolls in %.3f s: %.0f rolls/s\n", (unsigned long)latencies.size(), elapsed, latencies.size() / elapsed);
+	fprintf(stderr, "Latency: mean %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us\n",
+		total / latencies.size() * 1e6,
+		latencies[latencies.size() / 2] * 1e6,
+		latencies[latencies.size() * 99 / 100] * 1e6,
+		latencies.back() * 1e6);
+}
+
+
+
+static void PrintCacheStats(const RollEngine& RE)
+{
+	unsigned long hits, misses;
+	RE.GetExpressionCacheStats(hits, misses);
+	fprintf(stderr, "Expression cache: %lu hits, %lu misses\n", hits, misses);
+}
+
+
+
+static void Usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-n nick] [-s secret] [-S sequence] [-r repeats] [-c cachesize] [-d] [-f] [-q] [-t] [file ...]\n", name);
+	fprintf(stderr, "  -n nick      Roll as if to an IRC channel for the given nick.\n");
+	fprintf(stderr, "  -s secret    Use the module's stream-per-roll generator, keyed by the given\n");
+	fprintf(stderr, "               <roll secret>, so logged rolls can be replayed.\n");
+	fprintf(stderr, "  -S sequence  Sequence number of the first roll; incremented for each roll.\n");
+	fprintf(stderr, "  -r repeats   Perform each roll this many times, printing the last results.\n");
+	fprintf(stderr, "  -c cachesize Keep this many expressions compiled; 0 disables the cache.\n");
+	fprintf(stderr, "  -d           Print the preset and roll data after the results.\n");
+	fprintf(stderr, "  -f           Check the faces recorded for each expression add up to its\n");
+	fprintf(stderr, "               result, and exit with 1 if any don't.\n");
+	fprintf(stderr, "  -q           Don't print results.\n");
+	fprintf(stderr, "  -t           Print throughput, latency and expression cache hits to stderr\n");
+	fprintf(stderr, "               at the end.\n");
+}
+
+
+
+int main(int argc, char** argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "n:s:S:r:c:dfqth")) != -1)
+	{
+		switch (option)
+		{
+			case 'n':
+				nick = optarg;
+				break;
+			case 's':
+				secret = optarg;
+				break;
+			case 'S':
+				sequence = strtoull(optarg, NULL, 10);
+				break;
+			case 'r':
+				repeats = std::max(strtoul(optarg, NULL, 10), 1UL);
+				break;
+			case 'c':
+				cachesize = std::max(strtol(optarg, NULL, 10), 0L);
+				break;
+			case 'd':
+				showdata = true;
+				break;
+			case 'f':
+				checkfaces = true;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 't':
+				timing = true;
+				break;
+			default:
+				Usage(argv[0]);
+				return option == 'h' ? 0 : 1;
+		}
+	}
+
+	RollEngine RE;
+	if (secret)
+		RE.SetGenerator(new PhiloxGenerator(PhiloxGenerator::KeyFromSecret(secret)));
+	RE.SetExpressionCacheCapacity(cachesize);
+
+	double start = Now();
+	if (optind == argc)
+		RunStream(RE, std::cin);
+	for (int i = optind; i < argc; i++)
+	{
+		std::ifstream file(argv[i]);
+		if (!file)
+		{
+			fprintf(stderr, "%s: Unable to open %s.\n", argv[0], argv[i]);
+			return 1;
+		}
+		RunStream(RE, file);
+	}
+
+	if (timing)
+	{
+		PrintTimings(Now() - start);
+		PrintCacheStats(RE);
+	}
+	return mismatches ? 1 : 0;
+}